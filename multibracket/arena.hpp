@@ -0,0 +1,176 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <new>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Bump allocator that hands out memory from large blocks and frees
+ * all of it at once.
+ *
+ * Allocation is a pointer increment in the common case. Individual allocations
+ * can not be freed; instead, @c release makes all memory available for reuse
+ * in constant time, keeping the blocks allocated so far. Destructors of objects
+ * created in the arena are never run, so such objects must not own anything
+ * outside of it (containers should use an @c arena_allocator).
+ */
+class arena {
+public:
+    static constexpr size_t default_block_size = size_t(1) << 20;
+
+private:
+    struct block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<block> blocks;
+    size_t current;     //index of the block being filled
+    char* ptr;          //next free byte in the current block
+    char* end;          //end of the current block
+    size_t before;      //total size of the blocks before the current one
+    size_t block_size;
+
+    //Moves on to the next block that can hold n bytes with the given alignment,
+    //allocating a new one if needed
+    void next_block(size_t n, size_t align){
+        size_t need = n + align;
+
+        for(size_t i = blocks.empty() ? 0 : current + 1; i < blocks.size(); i++){
+            if(blocks[i].size >= need){
+                //Unused blocks are interchangeable, so move this one into place
+                std::swap(blocks[i], blocks[current + 1]);
+                use_block(current + 1);
+                return;
+            }
+        }
+
+        block b;
+        b.size = std::max(need, block_size);
+        b.data = static_cast<char*>(::operator new(b.size));
+        size_t at = blocks.empty() ? 0 : current + 1;
+        blocks.insert(blocks.begin() + at, b);
+        use_block(at);
+    }
+
+    void use_block(size_t i){
+        if(i == 0)
+            before = 0;
+        else if(i == current + 1)
+            before += blocks[current].size;
+        else{
+            before = 0;
+            for(size_t j = 0; j < i; j++)
+                before += blocks[j].size;
+        }
+        current = i;
+        ptr = blocks[i].data;
+        end = blocks[i].data + blocks[i].size;
+    }
+
+public:
+    explicit arena(size_t bs = default_block_size)
+    : blocks(), current(0), ptr(nullptr), end(nullptr), before(0), block_size(bs) {};
+
+    arena(const arena&) = delete;
+    arena& operator= (const arena&) = delete;
+
+    ~arena(){
+        for(block& b : blocks)
+            ::operator delete(b.data);
+    }
+
+    /**
+     * @brief Allocates @p n bytes with the given alignment (a power of two).
+     */
+    void* allocate(size_t n, size_t align = alignof(std::max_align_t)){
+        uintptr_t p = (reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~uintptr_t(align - 1);
+        if(!ptr || p + n > reinterpret_cast<uintptr_t>(end)){
+            next_block(n, align);
+            p = (reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~uintptr_t(align - 1);
+        }
+
+        ptr = reinterpret_cast<char*>(p + n);
+        return reinterpret_cast<void*>(p);
+    }
+
+    /**
+     * @brief Constructs an object in the arena. Its destructor will not be run.
+     */
+    template< typename T, typename... Args >
+    T* create(Args&&... args){
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Copies a string into the arena.
+     */
+    std::string_view copy(std::string_view s){
+        if(s.empty())
+            return std::string_view();
+
+        char* p = static_cast<char*>(allocate(s.length(), 1));
+        std::memcpy(p, s.data(), s.length());
+        return std::string_view(p, s.length());
+    }
+
+    /**
+     * @brief Makes all memory available for reuse, invalidating everything
+     * allocated so far.
+     */
+    void release(){
+        if(!blocks.empty())
+            use_block(0);
+    }
+
+    /**
+     * @brief Memory in use since the last release, counting blocks that have been
+     * moved on from as full.
+     */
+    size_t used() const {
+        return blocks.empty() ? 0 : before + (ptr - blocks[current].data);
+    }
+
+    /**
+     * @brief Total size of the blocks held by the arena.
+     */
+    size_t capacity() const {
+        size_t total = 0;
+        for(const block& b : blocks)
+            total += b.size;
+        return total;
+    }
+};
+
+/**
+ * @brief Standard allocator adaptor for @c arena, for use with STL containers.
+ * Deallocation does nothing; the memory is reclaimed when the arena is released.
+ */
+template< typename T >
+struct arena_allocator {
+    using value_type = T;
+
+    arena* mem;
+
+    arena_allocator(arena& m) : mem(&m) {};
+    template< typename U >
+    arena_allocator(const arena_allocator<U>& other) : mem(other.mem) {};
+
+    T* allocate(size_t n){
+        return static_cast<T*>(mem->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) {}
+
+    template< typename U >
+    bool operator== (const arena_allocator<U>& other) const { return mem == other.mem; }
+    template< typename U >
+    bool operator!= (const arena_allocator<U>& other) const { return mem != other.mem; }
+};
+
+#endif
@@ -0,0 +1,113 @@
+#!/bin/sh
+# Checks that the options which should not change the output of multibracket do
+# not: on synthetic FORM output written by gen_form, the output with each of them
+# is compared with that of a plain run. --share is only checked on inputs in which
+# no body repeats (so that nothing is abbreviated), and gzip input only if gzip
+# support was compiled in.
+#
+# Usage, from the multibracket directory (normally through `make check'):
+#   sh bench/check.sh
+#
+# Environment:
+#   CHECK_DIR   where the inputs and outputs are kept (default: a temporary
+#               directory, which is removed afterwards)
+#   NOSIMD      a build of multibracket without SIMD, also compared with the plain
+#               run (default: ./multibracket-nosimd, if it exists)
+
+set -e
+
+if [ -n "$CHECK_DIR" ]; then
+    dir=$CHECK_DIR
+    mkdir -p "$dir"
+else
+    dir=$(mktemp -d)
+    trap 'rm -rf "$dir"' EXIT
+fi
+nosimd=${NOSIMD:-./multibracket-nosimd}
+failed=0
+
+# Compares the output file $2 of the check $1 with the plain output
+compare() {
+    if cmp -s "$dir/plain" "$2"; then
+        echo "ok      $1"
+    else
+        echo "FAILED  $1"
+        failed=1
+    fi
+}
+
+# Formats the file $1 with --follow while it stays unchanged, writing to $2, and
+# stops once the output has not grown for half a second (or after 20 s)
+follow() {
+    ./multibracket --follow="$1" $spec > "$2" &
+    pid=$!
+    last=0
+    still=0
+    for i in $(seq 200); do
+        sleep 0.1
+        size=$(wc -c < "$2")
+        if [ "$size" -gt 0 ] && [ "$size" -eq "$last" ]; then
+            still=$((still + 1))
+            [ $still -ge 5 ] && break
+        else
+            still=0
+        fi
+        last=$size
+    done
+    kill -INT $pid
+    wait $pid || true
+}
+
+# Inputs: several expressions of 4 levels, large enough to be split in batch mode,
+# and deeply wrapped bodies on 2 levels
+n=0
+for args in "--size=10M --expressions=3" "--size=2M --depth=2 --keys=300 --wrap=0.9"; do
+    n=$((n + 1))
+    input="$dir/form-$n.txt"
+    spec=$(./gen_form --spec $args)
+    ./gen_form $args > "$input"
+    echo "gen_form $args"
+
+    ./multibracket $spec < "$input" > "$dir/plain"
+
+    ./multibracket --stream $spec < "$input" > "$dir/out"
+    compare "--stream" "$dir/out"
+
+    ./multibracket --pipeline $spec < "$input" > "$dir/out"
+    compare "--pipeline" "$dir/out"
+
+    printf '%s\t%s\n' "$input" "$dir/out" > "$dir/list"
+    ./multibracket --batch="$dir/list" --jobs=4 $spec
+    compare "--batch" "$dir/out"
+
+    # Small enough to spill, so it may warn that the brackets take up much of it
+    ./multibracket --mem-limit=2M $spec < "$input" > "$dir/out" 2> /dev/null
+    compare "--mem-limit" "$dir/out"
+
+    ./multibracket --share $spec < "$input" > "$dir/out"
+    if grep -q '\[_MB_S' "$dir/out"; then
+        echo "skipped --share (bodies repeat)"
+    else
+        compare "--share" "$dir/out"
+    fi
+
+    follow "$input" "$dir/out"
+    compare "--follow" "$dir/out"
+
+    gzip -c "$input" > "$input.gz"
+    if ./multibracket $spec < "$input.gz" > "$dir/out" 2> "$dir/err"; then
+        compare "gzip input" "$dir/out"
+    elif grep -q "not compiled in" "$dir/err"; then
+        echo "skipped gzip input (no gzip support)"
+    else
+        cat "$dir/err"
+        compare "gzip input" "$dir/out"
+    fi
+
+    if [ -x "$nosimd" ]; then
+        "$nosimd" $spec < "$input" > "$dir/out"
+        compare "without SIMD" "$dir/out"
+    fi
+done
+
+exit $failed
@@ -0,0 +1,257 @@
+/*
+ * Generator of synthetic FORM output for benchmarking multibracket: expressions
+ * printed with `print +s' after `multibracket', i.e. one term per line of the form
+ *
+ *       + [_MB_]*a3*b17*c2 * ( + 12*x^3 - 5*x*y^2 )
+ *
+ * with bodies that may also be wrapped over several lines, plus some unchanged
+ * FORM output around the expressions. The bracket keys consist of at most one
+ * symbol per level (a1,...,aK for the first level, b1,...,bK for the second etc.)
+ * and appear in sorted order, so that the output is also suitable for --stream.
+ * The same options and seed always give the same output.
+ *
+ * Usage: gen_form [options] > output
+ *   --terms=N          number of bracketed terms (default 100000)
+ *   --size=S           approximate output size instead of a number of terms,
+ *                      with an optional suffix K, M or G
+ *   --expressions=E    number of expressions the terms are divided into (default:
+ *                      as few as possible using at most half of the keys each)
+ *   --depth=D          number of bracket levels (default 4)
+ *   --keys=K           number of symbols on each level (default 20)
+ *   --line-length=L    length of the body lines (default 70)
+ *   --wrap=P           fraction of bodies that are wrapped over several lines (default 0.5)
+ *   --seed=S           random seed (default 1)
+ *   --spec             print the arguments for multibracket instead
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+struct gen_options {
+    uint64_t terms = 100000;
+    uint64_t size = 0;
+    uint64_t expressions = 0;
+    size_t depth = 4;
+    size_t keys = 20;
+    size_t line_length = 70;
+    double wrap = 0.5;
+    uint64_t seed = 1;
+    bool spec = false;
+};
+
+uint64_t parse_size(const std::string& s){
+    char* end;
+    uint64_t n = std::strtoull(s.c_str(), &end, 10);
+    switch(*end){
+        case 'G': n <<= 10; [[fallthrough]];
+        case 'M': n <<= 10; [[fallthrough]];
+        case 'K': n <<= 10; end++; break;
+    }
+    if(*end || s.empty())
+        throw std::runtime_error("ERROR: invalid size " + s);
+    return n;
+}
+
+gen_options parse_options(int argc, const char** argv){
+    gen_options opt;
+    for(int arg = 1; arg < argc; arg++){
+        std::string a(argv[arg]);
+        size_t eq = a.find('=');
+        std::string name = a.substr(0, eq);
+        std::string val = (eq == std::string::npos) ? "" : a.substr(eq + 1);
+
+        if(name == "--terms")               opt.terms = parse_size(val);
+        else if(name == "--size")           opt.size = parse_size(val);
+        else if(name == "--expressions")    opt.expressions = parse_size(val);
+        else if(name == "--depth")          opt.depth = parse_size(val);
+        else if(name == "--keys")           opt.keys = parse_size(val);
+        else if(name == "--line-length")    opt.line_length = parse_size(val);
+        else if(name == "--wrap")           opt.wrap = std::atof(val.c_str());
+        else if(name == "--seed")           opt.seed = parse_size(val);
+        else if(name == "--spec")           opt.spec = true;
+        else
+            throw std::runtime_error("ERROR: unknown option " + a);
+    }
+
+    if(opt.depth < 1 || opt.depth > 26)
+        throw std::runtime_error("ERROR: depth must be between 1 and 26");
+    if(opt.keys < 1 || opt.line_length < 20)
+        throw std::runtime_error("ERROR: invalid options");
+    return opt;
+}
+
+class form_generator {
+private:
+    const gen_options& opt;
+    std::mt19937_64 rng;
+    std::string buf;
+    uint64_t written;
+
+    uint64_t uniform(uint64_t n){
+        return std::uniform_int_distribution<uint64_t>(0, n - 1)(rng);
+    }
+
+    void flush(){
+        std::cout.write(buf.data(), buf.size());
+        written += buf.size();
+        buf.clear();
+    }
+
+    //Appends a random term of the body, such as "+ 12*x^3*y"
+    void body_term(std::string& s){
+        s += uniform(2) ? "+ " : "- ";
+        s += std::to_string(1 + uniform(99));
+        s += "*x^";
+        s += std::to_string(1 + uniform(9));
+        if(uniform(3) == 0){
+            s += "*y^";
+            s += std::to_string(1 + uniform(4));
+        }
+    }
+
+    //The key of the term with the given number among all (keys+1)^depth keys,
+    //where digit 0 on a level means that the level's symbol is absent
+    std::string key(uint64_t combo){
+        std::vector<uint64_t> digits(opt.depth);
+        for(size_t lvl = opt.depth; lvl-- > 0; ){
+            digits[lvl] = combo % (opt.keys + 1);
+            combo /= (opt.keys + 1);
+        }
+
+        std::string k;
+        for(size_t lvl = 0; lvl < opt.depth; lvl++){
+            if(digits[lvl] == 0)
+                continue;
+            if(!k.empty())
+                k += '*';
+            k += char('a' + lvl);
+            k += std::to_string(digits[lvl]);
+        }
+        return k;
+    }
+
+    void term(const std::string& k, bool last){
+        buf += "       + [_MB_]";
+        if(!k.empty()){
+            buf += '*';
+            buf += k;
+        }
+        buf += " * (";
+
+        if(std::bernoulli_distribution(opt.wrap)(rng)){
+            size_t n_lines = 2 + uniform(4);
+            for(size_t l = 0; l < n_lines; l++){
+                std::string line = "          ";
+                do{
+                    body_term(line);
+                    line += ' ';
+                } while(line.length() + 16 < opt.line_length);
+                line.pop_back();
+                buf += '\n';
+                buf += line;
+            }
+            buf += "\n          )";
+        }
+        else{
+            std::string line = " ";
+            size_t room = opt.line_length / 2;
+            do{
+                body_term(line);
+                line += ' ';
+            } while(line.length() + 16 < room);
+            buf += line;
+            buf += ")";
+        }
+        buf += last ? ";\n" : "\n\n";
+
+        if(buf.size() > (size_t(1) << 20))
+            flush();
+    }
+
+public:
+    form_generator(const gen_options& o) : opt(o), rng(o.seed), buf(), written(0) {};
+
+    void run(){
+        uint64_t n_combos = 1;
+        for(size_t lvl = 0; lvl < opt.depth; lvl++){
+            if(n_combos > UINT64_MAX / (opt.keys + 1))
+                throw std::runtime_error("ERROR: too many keys");
+            n_combos *= opt.keys + 1;
+        }
+
+        uint64_t terms = opt.terms;
+        if(opt.size){
+            //Estimate the size of a term from a sample
+            form_generator sample(opt);
+            for(int i = 0; i < 1000; i++)
+                sample.term(sample.key(sample.uniform(n_combos)), false);
+            terms = std::max<uint64_t>(1, opt.size * 1000 / sample.buf.size());
+        }
+
+        uint64_t expressions = opt.expressions;
+        if(expressions == 0)
+            expressions = (terms + n_combos / 2) / std::max<uint64_t>(1, n_combos / 2);
+        uint64_t per_expr = (terms + expressions - 1) / expressions;
+        if(per_expr > n_combos)
+            throw std::runtime_error("ERROR: not enough distinct keys, increase --keys or --depth");
+
+        buf += "FORM 4.2.1 (Jan 2020) 64-bits                 Run: Mon Jan  1 00:00:00 2024\n";
+        buf += "    #include multibracket.hf\n    #-\n\n";
+
+        for(uint64_t e = 0, done = 0; e < expressions && done < terms; e++){
+            uint64_t n = std::min(per_expr, terms - done);
+
+            buf += "Time =       0.01 sec    Generated terms =     " + std::to_string(n) + "\n";
+            buf += "            E" + std::to_string(e) + "        Terms in output =     " + std::to_string(n) + "\n";
+            buf += "                         Bytes used      =     " + std::to_string(64 * n) + "\n\n";
+            buf += "   E" + std::to_string(e) + " =\n";
+
+            //Spread the terms evenly over the sorted keys
+            for(uint64_t i = 0; i < n; i++){
+                uint64_t lo = (unsigned __int128)i * n_combos / n;
+                uint64_t hi = (unsigned __int128)(i + 1) * n_combos / n;
+                term(key(lo + uniform(hi - lo)), i == n - 1);
+            }
+            buf += "\n";
+            done += n;
+        }
+
+        buf += "  0.01 sec out of 0.01 sec\n";
+        flush();
+    }
+
+    //The arguments for multibracket: one range of symbols per level
+    std::string spec() const {
+        std::string s;
+        for(size_t lvl = 0; lvl < opt.depth; lvl++){
+            std::string sym(1, char('a' + lvl));
+            if(lvl > 0)
+                s += ' ';
+            s += sym + "1";
+            if(opt.keys > 1)
+                s += ",...," + sym + std::to_string(opt.keys);
+        }
+        return s;
+    }
+};
+
+int main(int argc, const char** argv){
+    try{
+        gen_options opt = parse_options(argc, argv);
+        form_generator gen(opt);
+
+        if(opt.spec)
+            std::cout << gen.spec() << std::endl;
+        else
+            gen.run();
+    } catch (std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
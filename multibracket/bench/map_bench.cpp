@@ -0,0 +1,107 @@
+/*
+ * Micro-benchmark comparing insertion_order_map with flat_insertion_order_map
+ * on workloads resembling those in multibracket: a table of symbol names that is
+ * filled once and then queried by string_view heads, and many small maps of
+ * bracket keys that are filled, looked up and iterated.
+ *
+ * Usage: map_bench [number of keys] [number of lookups]
+ */
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <random>
+
+#include "../insertion_order_map.hpp"
+#include "../flat_insertion_order_map.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+template< typename F >
+double time_ms(F f){
+    auto start = bench_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+//Keys that look like FORM factors, e.g. "F(a12,b3)"
+std::vector<std::string> make_keys(size_t n, std::mt19937& rng){
+    std::vector<std::string> keys;
+    for(size_t i = 0; i < n; i++){
+        std::string k = (i % 3 == 0) ? "F(a" : (i % 3 == 1) ? "mass" : "den(p";
+        k += std::to_string(i);
+        if(i % 3 != 1)
+            k += ",x" + std::to_string(rng() % 100) + ")";
+        keys.push_back(k);
+    }
+    return keys;
+}
+
+//Fills a map, then looks up a mix of present and absent keys and iterates over it.
+//Lookups by string_view have to construct a std::string for the list-based map.
+template< typename Map, bool by_view >
+size_t workload(const std::vector<std::string>& keys, const std::vector<std::string_view>& queries,
+                size_t n_maps)
+{
+    size_t sink = 0;
+    size_t per_map = keys.size() / n_maps;
+
+    for(size_t m = 0; m < n_maps; m++){
+        Map map;
+        for(size_t i = m * per_map; i < (m + 1) * per_map; i++)
+            map[keys[i]] = i;
+
+        for(std::string_view q : queries){
+            typename Map::iterator it;
+            if constexpr (by_view)
+                it = map.find(q);
+            else
+                it = map.find(std::string(q));
+
+            if(it != map.end())
+                sink += it->second;
+        }
+
+        for(auto& kv : map)
+            sink += kv.first.length();
+    }
+    return sink;
+}
+
+template< typename Map, bool by_view >
+void run(const char* name, const std::vector<std::string>& keys,
+         const std::vector<std::string_view>& queries, size_t n_maps)
+{
+    size_t sink = 0;
+    double ms = time_ms([&]{ sink = workload<Map, by_view>(keys, queries, n_maps); });
+    std::cout << "  " << name << ": " << ms << " ms (checksum " << sink << ")\n";
+}
+
+int main(int argc, const char** argv){
+    size_t n_keys = argc > 1 ? std::stoul(argv[1]) : 100000;
+    size_t n_queries = argc > 2 ? std::stoul(argv[2]) : 1000000;
+
+    std::mt19937 rng(12345);
+    std::vector<std::string> keys = make_keys(n_keys, rng);
+    std::vector<std::string> absent = make_keys(n_keys, rng);   //different random suffixes
+    std::vector<std::string_view> queries;
+    for(size_t i = 0; i < n_queries; i++)
+        queries.push_back( (i % 4 == 0 ? absent : keys)[rng() % n_keys] );
+
+    using list_map = insertion_order_map<std::string, size_t>;
+    using flat_map = flat_insertion_order_map<std::string, size_t>;
+
+    std::cout << "One map of " << n_keys << " keys, " << n_queries << " lookups:\n";
+    run<list_map, false>("insertion_order_map     ", keys, queries, 1);
+    run<flat_map, true >("flat_insertion_order_map", keys, queries, 1);
+
+    //Many small maps, as for the sub-brackets of a large expression
+    size_t n_maps = n_keys / 8;
+    std::vector<std::string_view> few(queries.begin(), queries.begin() + 8);
+    std::cout << n_maps << " maps of 8 keys, 8 lookups each:\n";
+    run<list_map, false>("insertion_order_map     ", keys, few, n_maps);
+    run<flat_map, true >("flat_insertion_order_map", keys, few, n_maps);
+
+    return 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * Benchmark harness for multibracket. Formats an input file (such as one written
+ * by gen_form) in several phases, each in a child process of its own, so that the
+ * peak memory use of each phase is measured separately:
+ *
+ *   passthrough    reading the input as text outside tagged expressions (through
+ *                  term_lexer) and copying it to the output unchanged
+ *   parse          parsing the input into bracket trees through the library
+ *                  (multibracket_parser), reporting them to handlers that ignore
+ *                  them
+ *   print          laying out and printing the trees: the time of formatting the
+ *                  input through the library, less that of parsing it; the peak
+ *                  RSS is that of formatting
+ *   total          a full run of run_multibracket(), i.e. what multibracket itself
+ *                  does
+ *
+ * Only the library interface (multibracket.hpp) and the stand-alone headers of
+ * the input classes are used. All output goes to /dev/null. Each phase is run
+ * --repeat times, and the fastest time is reported with the largest peak RSS.
+ * With --compare=BIN, the executable BIN (e.g. another build of multibracket) is
+ * also run on the input with the same arguments, so that implementations can be
+ * compared.
+ *
+ * Usage: mb_bench [--stream] [--repeat=N] [--compare=BIN]... FILE SPEC...
+ */
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "../line_reader.hpp"
+#include "../term_lexer.hpp"
+#include "../multibracket.hpp"
+
+//Multibracket tag, as in libmultibracket.cpp
+#define MULTIBRACKET "       + [_MB_]"
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start){
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+//What a phase reports back from its child process
+struct phase_result {
+    double seconds = 0;
+    uint64_t terms = 0;
+    double peak_rss_mb = 0;
+};
+
+struct bench_settings {
+    std::string path;
+    std::vector<std::string> specs;
+    std::unique_ptr<multibracket_spec> spec;
+    bool streaming = false;
+};
+
+//Ignores the structure reported by the parser
+struct discard_events : multibracket_events {};
+
+//Writes the formatted output to a file descriptor
+struct fd_sink : output_sink {
+    int fd;
+
+    explicit fd_sink(int f) : fd(f) {};
+
+    void write(const char* data, size_t n){
+        while(n > 0){
+            ssize_t done = ::write(fd, data, n);
+            if(done <= 0)
+                throw std::runtime_error("ERROR: could not write output");
+            data += done;
+            n -= done;
+        }
+    }
+};
+
+//Feeds the mapped input to a parser in blocks, as a program using the library would
+void feed_input(multibracket_parser& parser, const std::string& path){
+    static constexpr size_t feed_size = size_t(1) << 20;
+
+    line_reader in(path);
+    std::string_view text = in.contents();
+    for(size_t pos = 0; pos < text.length(); pos += feed_size)
+        parser.feed(text.substr(pos, feed_size));
+    parser.finish();
+}
+
+phase_result passthrough_phase(const bench_settings& settings){
+    std::ofstream null("/dev/null");
+
+    bench_clock::time_point start = bench_clock::now();
+    {
+        //The whole input is taken as text outside expressions, which is passed on in
+        //blocks as in a full run. No line of FORM output starts with a NUL byte.
+        line_reader in(settings.path);
+        term_lexer lexer(in, std::string_view("\0", 1));
+        for(term_lexer::token t; (t = lexer.next()) != term_lexer::token::end_of_input; )
+            null << '\n' << lexer.value();
+    }
+    null.flush();
+
+    phase_result r;
+    r.seconds = seconds_since(start);
+    return r;
+}
+
+phase_result parse_phase(const bench_settings& settings){
+    phase_result r;
+    bench_clock::time_point start = bench_clock::now();
+    {
+        discard_events events;
+        multibracket_parser parser(*settings.spec, events, settings.streaming);
+        feed_input(parser, settings.path);
+    }
+    r.seconds = seconds_since(start);
+
+    //Count the terms outside the timing
+    line_reader in(settings.path);
+    for(std::string_view line; in.getline(line); )
+        r.terms += (line.compare(0, std::strlen(MULTIBRACKET), MULTIBRACKET) == 0);
+    return r;
+}
+
+phase_result format_phase(const bench_settings& settings){
+    int null = ::open("/dev/null", O_WRONLY);
+    if(null < 0)
+        throw std::runtime_error("ERROR: could not open /dev/null");
+
+    phase_result r;
+    bench_clock::time_point start = bench_clock::now();
+    {
+        fd_sink sink(null);
+        multibracket_parser parser(*settings.spec, sink, settings.streaming);
+        feed_input(parser, settings.path);
+    }
+    r.seconds = seconds_since(start);
+    ::close(null);
+    return r;
+}
+
+phase_result total_phase(const bench_settings& settings){
+    int in = ::open(settings.path.c_str(), O_RDONLY);
+    if(in < 0 || ::dup2(in, STDIN_FILENO) < 0)
+        throw std::runtime_error("ERROR: could not open " + settings.path);
+    ::close(in);
+
+    multibracket_options opts;
+    opts.specs = settings.specs;
+    opts.streaming = settings.streaming;
+    opts.output_path = "/dev/null";
+
+    bench_clock::time_point start = bench_clock::now();
+    if(run_multibracket(opts) != 0)
+        throw std::runtime_error("ERROR: run_multibracket failed");
+
+    phase_result r;
+    r.seconds = seconds_since(start);
+    return r;
+}
+
+//Runs a phase in a child process, which passes its result back through a pipe
+template< typename F >
+phase_result run_phase(F phase){
+    int fds[2];
+    if(::pipe(fds) != 0)
+        throw std::runtime_error("ERROR: could not create pipe");
+
+    std::cout.flush();
+    pid_t pid = ::fork();
+    if(pid < 0)
+        throw std::runtime_error("ERROR: could not fork");
+
+    if(pid == 0){
+        ::close(fds[0]);
+        int status = 0;
+        try{
+            phase_result r = phase();
+            if(::write(fds[1], &r, sizeof(r)) != ssize_t(sizeof(r)))
+                status = 1;
+        } catch (std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            status = 1;
+        }
+        ::_exit(status);
+    }
+
+    ::close(fds[1]);
+    phase_result r;
+    bool ok = (::read(fds[0], &r, sizeof(r)) == ssize_t(sizeof(r)));
+    ::close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    ::wait4(pid, &status, 0, &usage);
+    if(!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("ERROR: benchmark phase failed");
+
+    r.peak_rss_mb = usage.ru_maxrss / 1024.0;
+    return r;
+}
+
+//Runs another executable on the input, as a shell would for `bin specs < file'
+phase_result compare_phase(const std::string& bin, const bench_settings& settings){
+    std::vector<const char*> argv;
+    argv.push_back(bin.c_str());
+    if(settings.streaming)
+        argv.push_back("--stream");
+    for(const std::string& spec : settings.specs)
+        argv.push_back(spec.c_str());
+    argv.push_back(nullptr);
+
+    bench_clock::time_point start = bench_clock::now();
+    pid_t pid = ::fork();
+    if(pid < 0)
+        throw std::runtime_error("ERROR: could not fork");
+
+    if(pid == 0){
+        int in = ::open(settings.path.c_str(), O_RDONLY);
+        int out = ::open("/dev/null", O_WRONLY);
+        if(in < 0 || out < 0)
+            ::_exit(127);
+        ::dup2(in, STDIN_FILENO);
+        ::dup2(out, STDOUT_FILENO);
+        ::execv(bin.c_str(), const_cast<char* const*>(argv.data()));
+        ::_exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    ::wait4(pid, &status, 0, &usage);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("ERROR: " + bin + " failed");
+
+    phase_result r;
+    r.seconds = seconds_since(start);
+    r.peak_rss_mb = usage.ru_maxrss / 1024.0;
+    return r;
+}
+
+//Best time and largest peak RSS of several runs
+template< typename F >
+phase_result repeat_phase(size_t repeat, F phase){
+    phase_result best = phase();
+    for(size_t i = 1; i < repeat; i++){
+        phase_result r = phase();
+        best.seconds = std::min(best.seconds, r.seconds);
+        best.peak_rss_mb = std::max(best.peak_rss_mb, r.peak_rss_mb);
+    }
+    return best;
+}
+
+void print_row(const std::string& name, double seconds, double mb, uint64_t terms, double rss){
+    std::cout << std::left << std::setw(24) << name << std::right << std::fixed
+              << std::setw(10) << std::setprecision(3) << seconds
+              << std::setw(10) << std::setprecision(1) << mb / seconds;
+    if(terms)
+        std::cout << std::setw(11) << std::setprecision(2) << terms / seconds / 1e6;
+    else
+        std::cout << std::setw(11) << "-";
+    if(rss > 0)
+        std::cout << std::setw(15) << std::setprecision(1) << rss;
+    else
+        std::cout << std::setw(15) << "-";
+    std::cout << "\n";
+}
+
+int main(int argc, const char** argv){
+    bench_settings settings;
+    size_t repeat = 1;
+    std::vector<std::string> compare;
+
+    for(int arg = 1; arg < argc; arg++){
+        std::string a(argv[arg]);
+
+        if(a == "--stream")
+            settings.streaming = true;
+        else if(a.compare(0, 9, "--repeat=") == 0)
+            repeat = std::max(1ul, std::strtoul(a.c_str() + 9, nullptr, 10));
+        else if(a.compare(0, 10, "--compare=") == 0)
+            compare.push_back(a.substr(10));
+        else if(a.compare(0, 2, "--") == 0){
+            std::cerr << "ERROR: unknown option " << a << std::endl;
+            return 1;
+        }
+        else if(settings.path.empty())
+            settings.path = a;
+        else
+            settings.specs.push_back(a);
+    }
+    if(settings.path.empty()){
+        std::cerr << "Usage: mb_bench [--stream] [--repeat=N] [--compare=BIN]... FILE SPEC..." << std::endl;
+        return 1;
+    }
+
+    try{
+        settings.spec.reset(new multibracket_spec(settings.specs));
+
+        struct stat st;
+        if(::stat(settings.path.c_str(), &st) != 0)
+            throw std::runtime_error("ERROR: could not open " + settings.path);
+        double mb = st.st_size / 1e6;
+
+        phase_result pass = repeat_phase(repeat, [&]{ return run_phase([&]{ return passthrough_phase(settings); }); });
+        phase_result parse = repeat_phase(repeat, [&]{ return run_phase([&]{ return parse_phase(settings); }); });
+        phase_result format = repeat_phase(repeat, [&]{ return run_phase([&]{ return format_phase(settings); }); });
+        phase_result full = repeat_phase(repeat, [&]{ return run_phase([&]{ return total_phase(settings); }); });
+
+        std::cout << settings.path << ": " << std::fixed << std::setprecision(1) << mb << " MB, "
+                  << parse.terms << " terms" << (settings.streaming ? ", streaming" : "") << "\n";
+        std::cout << std::left << std::setw(24) << "phase" << std::right
+                  << std::setw(10) << "time (s)" << std::setw(10) << "MB/s"
+                  << std::setw(11) << "Mterms/s" << std::setw(15) << "peak RSS (MB)" << "\n";
+        print_row("passthrough", pass.seconds, mb, 0, pass.peak_rss_mb);
+        print_row("parse", parse.seconds, mb, parse.terms, parse.peak_rss_mb);
+        print_row("print", std::max(0.0, format.seconds - parse.seconds), mb, parse.terms, format.peak_rss_mb);
+        print_row("total", full.seconds, mb, parse.terms, full.peak_rss_mb);
+
+        for(const std::string& bin : compare){
+            phase_result r = repeat_phase(repeat, [&]{ return compare_phase(bin, settings); });
+            print_row(bin, r.seconds, mb, parse.terms, r.peak_rss_mb);
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
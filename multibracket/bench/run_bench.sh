@@ -0,0 +1,39 @@
+#!/bin/sh
+# Runs mb_bench on synthetic FORM output of several sizes written by gen_form.
+# The inputs are generated once and kept, so that later runs (e.g. of another
+# build) measure exactly the same input.
+#
+# Usage, from the multibracket directory (normally through `make bench'):
+#   sh bench/run_bench.sh [SIZE...]     sizes as for gen_form --size (default: 1M 10M 100M)
+#
+# Environment:
+#   BENCH_DIR   where the inputs are kept (default: /tmp/multibracket-bench);
+#               note that a 10G input takes 10 GB of disk space
+#   GEN_ARGS    further options for gen_form, e.g. "--depth=2 --wrap=0.9"
+#   BENCH_ARGS  further options for mb_bench, e.g. "--stream --repeat=3"
+#   COMPARE     executables to time on the same inputs (default: ./multibracket)
+
+set -e
+
+dir=${BENCH_DIR:-/tmp/multibracket-bench}
+sizes=${*:-"1M 10M 100M"}
+compare=${COMPARE-./multibracket}
+
+mkdir -p "$dir"
+spec=$(./gen_form --spec $GEN_ARGS)
+compare_args=
+for bin in $compare; do
+    compare_args="$compare_args --compare=$bin"
+done
+
+for size in $sizes; do
+    key=$(echo "$size $GEN_ARGS" | cksum | cut -d' ' -f1)
+    input="$dir/form-$size-$key.txt"
+    if [ ! -f "$input" ]; then
+        ./gen_form --size="$size" $GEN_ARGS > "$input.tmp"
+        mv "$input.tmp" "$input"
+    fi
+
+    ./mb_bench $BENCH_ARGS $compare_args "$input" $spec
+    echo
+done
@@ -0,0 +1,511 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include <atomic>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+
+#ifdef MULTIBRACKET_ZLIB
+    #include <zlib.h>
+#endif
+#ifdef MULTIBRACKET_ZSTD
+    #include <zstd.h>
+#endif
+
+#include "spsc_queue.hpp"
+
+/*
+ * Compressed input and output. Support for gzip is compiled in if MULTIBRACKET_ZLIB
+ * is defined (linking with -lz), and for zstd if MULTIBRACKET_ZSTD is defined
+ * (linking with -lzstd); the makefile does so if the headers are found. Input is
+ * recognised by its magic bytes, output by the extension of the file name.
+ */
+enum class codec { none, gzip, zstd };
+
+inline const char* codec_name(codec c){
+    static const char* const names[] = {"uncompressed", "gzip", "zstd"};
+    return names[size_t(c)];
+}
+
+//Throws if support for a codec was not compiled in
+inline void require_codec(codec c){
+#ifndef MULTIBRACKET_ZLIB
+    if(c == codec::gzip)
+        throw std::runtime_error("ERROR: gzip support was not compiled in (needs zlib)");
+#endif
+#ifndef MULTIBRACKET_ZSTD
+    if(c == codec::zstd)
+        throw std::runtime_error("ERROR: zstd support was not compiled in (needs libzstd)");
+#endif
+}
+
+//Codec for an output file, by its extension (.gz or .zst)
+inline codec codec_for_path(const std::string& path){
+    auto ends_with = [&](const char* ext){
+        size_t n = std::strlen(ext);
+        return path.length() > n && path.compare(path.length() - n, n, ext) == 0;
+    };
+    if(ends_with(".gz"))
+        return codec::gzip;
+    if(ends_with(".zst"))
+        return codec::zstd;
+    return codec::none;
+}
+
+namespace detail {
+
+    //Reads up to n bytes, returning 0 at the end of the input, or as soon as
+    //stop_fd (if not -1) becomes readable
+    inline size_t read_some(int fd, char* buf, size_t n, int stop_fd = -1){
+        for(;;){
+            if(stop_fd >= 0){
+                struct pollfd p[2] = { {fd, POLLIN, 0}, {stop_fd, POLLIN, 0} };
+                if(::poll(p, 2, -1) < 0){
+                    if(errno == EINTR)
+                        continue;
+                    throw std::runtime_error(std::string("ERROR: could not read input: ") + std::strerror(errno));
+                }
+                if(p[1].revents)
+                    return 0;
+            }
+            
+            ssize_t got = ::read(fd, buf, n);
+            if(got >= 0)
+                return size_t(got);
+            if(errno != EINTR)
+                throw std::runtime_error(std::string("ERROR: could not read input: ") + std::strerror(errno));
+        }
+    }
+
+    inline void write_all(int fd, const char* buf, size_t n){
+        while(n > 0){
+            ssize_t done = ::write(fd, buf, n);
+            if(done < 0 && errno == EINTR)
+                continue;
+            if(done <= 0)
+                throw std::runtime_error(std::string("ERROR: could not write output: ") + std::strerror(errno));
+            buf += done;
+            n -= done;
+        }
+    }
+}
+
+/**
+ * @brief Reads from a file descriptor, decompressing gzip or zstd input on the fly.
+ *
+ * The codec is recognised by the magic bytes at the start of the input, which are
+ * read with @c pread() if possible (so that nothing is consumed), and otherwise
+ * kept and handed out again. If the input is uncompressed and nothing had to be
+ * consumed, @c passthrough() is true and the file descriptor may just as well be
+ * read directly (e.g. by a @c line_reader, which can then map a regular file).
+ * Concatenated gzip members and zstd frames are read one after the other.
+ *
+ * A @c read() in another thread, which may be waiting for input that will never
+ * come, can be ended with @c cancel(), after which the input appears to end.
+ */
+class decompressing_reader {
+private:
+    static constexpr size_t in_size = size_t(1) << 18;
+
+    int fd;
+    codec type;
+    bool peeked;                //whether the magic bytes had to be consumed
+
+    std::vector<char> in;       //input not yet decompressed
+    size_t in_pos;
+    size_t in_len;
+    bool at_end;                //whether the last member or frame was complete
+    bool output_pending;        //whether the decoder may hold more output
+
+    int wake[2];                //pipe written to by cancel()
+    std::atomic<bool> cancelled;
+
+#ifdef MULTIBRACKET_ZLIB
+    z_stream zs;
+#endif
+#ifdef MULTIBRACKET_ZSTD
+    ZSTD_DCtx* dctx = nullptr;
+#endif
+
+    bool fill(){
+        in_pos = 0;
+        in_len = detail::read_some(fd, in.data(), in.size(), wake[0]);
+        return in_len > 0;
+    }
+
+    //Decompresses from the input buffer into buf, returning the number of bytes produced
+    size_t decode(char* buf, size_t n){
+        size_t produced = 0;
+#ifdef MULTIBRACKET_ZLIB
+        if(type == codec::gzip){
+            size_t before = in_pos;
+            zs.next_in = reinterpret_cast<Bytef*>(in.data() + in_pos);
+            zs.avail_in = uInt(in_len - in_pos);
+            zs.next_out = reinterpret_cast<Bytef*>(buf);
+            zs.avail_out = uInt(std::min<size_t>(n, UINT_MAX));
+            uInt avail = zs.avail_out;
+
+            int r = inflate(&zs, Z_NO_FLUSH);
+            in_pos = in_len - zs.avail_in;
+            produced = avail - zs.avail_out;
+            if(r == Z_STREAM_END){
+                at_end = true;
+                inflateReset(&zs);
+            }
+            else if(r == Z_OK || r == Z_BUF_ERROR){
+                if(produced > 0 || in_pos > before)
+                    at_end = false;
+            }
+            else
+                throw std::runtime_error("ERROR: corrupt gzip input" + std::string(zs.msg ? ": " : "")
+                                         + (zs.msg ? zs.msg : ""));
+            output_pending = (zs.avail_out == 0);
+        }
+#endif
+#ifdef MULTIBRACKET_ZSTD
+        if(type == codec::zstd){
+            ZSTD_inBuffer src{in.data(), in_len, in_pos};
+            ZSTD_outBuffer dst{buf, n, 0};
+            size_t r = ZSTD_decompressStream(dctx, &dst, &src);
+            if(ZSTD_isError(r))
+                throw std::runtime_error(std::string("ERROR: corrupt zstd input: ") + ZSTD_getErrorName(r));
+            in_pos = src.pos;
+            produced = dst.pos;
+            at_end = (r == 0);
+            output_pending = (dst.pos == dst.size);
+        }
+#endif
+        return produced;
+    }
+
+public:
+    explicit decompressing_reader(int f)
+    : fd(f), type(codec::none), peeked(false), in(in_size), in_pos(0), in_len(0),
+      at_end(false), output_pending(false), wake{-1, -1}, cancelled(false)
+    {
+        unsigned char magic[4] = {};
+        size_t n = 0;
+        off_t at = ::lseek(fd, 0, SEEK_CUR);
+        ssize_t got = (at >= 0) ? ::pread(fd, magic, sizeof(magic), at) : -1;
+        if(got >= 0)
+            n = size_t(got);
+        else{
+            //Not seekable: keep what was read
+            peeked = true;
+            while(n < sizeof(magic)){
+                size_t m = detail::read_some(fd, in.data() + n, sizeof(magic) - n);
+                if(m == 0)
+                    break;
+                n += m;
+            }
+            in_len = n;
+            std::memcpy(magic, in.data(), n);
+        }
+
+        if(n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+            type = codec::gzip;
+        else if(n >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+            type = codec::zstd;
+        require_codec(type);
+
+#ifdef MULTIBRACKET_ZLIB
+        if(type == codec::gzip){
+            std::memset(&zs, 0, sizeof(zs));
+            if(inflateInit2(&zs, 15 + 16) != Z_OK)
+                throw std::runtime_error("ERROR: could not initialise zlib");
+        }
+#endif
+#ifdef MULTIBRACKET_ZSTD
+        if(type == codec::zstd){
+            dctx = ZSTD_createDCtx();
+            if(!dctx)
+                throw std::runtime_error("ERROR: could not initialise zstd");
+        }
+#endif
+        //Without the pipe, cancel() only takes effect once a read returns
+        if(::pipe2(wake, O_CLOEXEC) != 0)
+            wake[0] = wake[1] = -1;
+    }
+
+    decompressing_reader(const decompressing_reader&) = delete;
+    decompressing_reader& operator= (const decompressing_reader&) = delete;
+
+    ~decompressing_reader(){
+        if(wake[0] >= 0){
+            ::close(wake[0]);
+            ::close(wake[1]);
+        }
+#ifdef MULTIBRACKET_ZLIB
+        if(type == codec::gzip)
+            inflateEnd(&zs);
+#endif
+#ifdef MULTIBRACKET_ZSTD
+        if(dctx)
+            ZSTD_freeDCtx(dctx);
+#endif
+    }
+
+    codec format() const {
+        return type;
+    }
+
+    bool passthrough() const {
+        return type == codec::none && !peeked;
+    }
+
+    //Makes the input end at once, also for a read() waiting in another thread
+    void cancel(){
+        cancelled = true;
+        if(wake[1] >= 0){
+            char c = 0;
+            ssize_t r = ::write(wake[1], &c, 1);
+            (void)r;
+        }
+    }
+
+    /**
+     * @brief Reads up to @p n bytes of decompressed input into @p buf, returning the
+     * number read (0 at the end). Throws if the input is corrupt or truncated.
+     */
+    size_t read(char* buf, size_t n){
+        if(type == codec::none){
+            if(in_pos < in_len){
+                n = std::min(n, in_len - in_pos);
+                std::memcpy(buf, in.data() + in_pos, n);
+                in_pos += n;
+                return n;
+            }
+            return cancelled ? 0 : detail::read_some(fd, buf, n, wake[0]);
+        }
+
+        for(;;){
+            if(cancelled)
+                return 0;
+            if(in_pos == in_len && !output_pending && !fill()){
+                if(!at_end && !cancelled)
+                    throw std::runtime_error(std::string("ERROR: ") + codec_name(type) + " input is truncated");
+                return 0;
+            }
+            size_t produced = decode(buf, n);
+            if(produced > 0)
+                return produced;
+        }
+    }
+};
+
+namespace detail {
+
+    /*
+     * Stream buffer behind compressed_ostream. Output is collected in blocks,
+     * which are handed to a worker thread that compresses them and writes the
+     * result, so that the writer only waits when the worker falls behind by more
+     * than a few blocks. Used blocks are handed back to be refilled.
+     */
+    class compress_buf : public std::streambuf {
+    private:
+        static constexpr size_t block_size = size_t(1) << 18;
+        static constexpr size_t out_size = size_t(1) << 18;
+        static constexpr size_t queued_blocks = 8;
+
+        int fd;
+        codec type;
+        std::vector<char> block;
+        spsc_queue< std::vector<char> > blocks;
+        spsc_queue< std::vector<char> > spare;     //room for all blocks there can be
+        std::exception_ptr error;
+        std::thread worker;
+        bool closed;
+
+        void hand_over(){
+            if(pptr() == pbase())
+                return;
+
+            block.resize(pptr() - pbase());
+            blocks.push(std::move(block));
+            if(!spare.try_pop(block))
+                block.clear();
+            block.resize(block_size);
+            setp(block.data(), block.data() + block.size());
+        }
+
+        //Compresses all blocks and writes them (in the worker thread)
+        void compress(){
+            std::vector<char> out(out_size);
+            std::vector<char> b;
+#ifdef MULTIBRACKET_ZLIB
+            if(type == codec::gzip){
+                z_stream zs;
+                std::memset(&zs, 0, sizeof(zs));
+                if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                    throw std::runtime_error("ERROR: could not initialise zlib");
+
+                bool more = true;
+                while(more){
+                    more = blocks.pop(b);
+                    zs.next_in = reinterpret_cast<Bytef*>(b.data());
+                    zs.avail_in = more ? uInt(b.size()) : 0;
+                    int r;
+                    do{
+                        zs.next_out = reinterpret_cast<Bytef*>(out.data());
+                        zs.avail_out = uInt(out.size());
+                        r = deflate(&zs, more ? Z_NO_FLUSH : Z_FINISH);
+                        write_all(fd, out.data(), out.size() - zs.avail_out);
+                    } while(zs.avail_out == 0 || (!more && r != Z_STREAM_END));
+                    if(more)
+                        spare.push(std::move(b));
+                }
+                deflateEnd(&zs);
+                return;
+            }
+#endif
+#ifdef MULTIBRACKET_ZSTD
+            if(type == codec::zstd){
+                ZSTD_CCtx* cctx = ZSTD_createCCtx();
+                if(!cctx)
+                    throw std::runtime_error("ERROR: could not initialise zstd");
+
+                try{
+                    bool more = true;
+                    while(more){
+                        more = blocks.pop(b);
+                        ZSTD_inBuffer src{b.data(), more ? b.size() : 0, 0};
+                        size_t left;
+                        do{
+                            ZSTD_outBuffer dst{out.data(), out.size(), 0};
+                            left = ZSTD_compressStream2(cctx, &dst, &src, more ? ZSTD_e_continue : ZSTD_e_end);
+                            if(ZSTD_isError(left))
+                                throw std::runtime_error(std::string("ERROR: zstd: ") + ZSTD_getErrorName(left));
+                            write_all(fd, out.data(), dst.pos);
+                        } while(more ? src.pos < src.size : left != 0);
+                        if(more)
+                            spare.push(std::move(b));
+                    }
+                } catch (...) {
+                    ZSTD_freeCCtx(cctx);
+                    throw;
+                }
+                ZSTD_freeCCtx(cctx);
+                return;
+            }
+#endif
+            while(blocks.pop(b)){
+                write_all(fd, b.data(), b.size());
+                spare.push(std::move(b));
+            }
+        }
+
+    protected:
+        virtual int_type overflow(int_type c){
+            hand_over();
+            if(!traits_type::eq_int_type(c, traits_type::eof())){
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        virtual int sync(){
+            hand_over();
+            return 0;
+        }
+
+    public:
+        compress_buf(int f, codec c)
+        : fd(f), type(c), block(block_size), blocks(queued_blocks), spare(queued_blocks + 2),
+          error(), worker(), closed(false)
+        {
+            require_codec(type);
+            setp(block.data(), block.data() + block.size());
+            worker = std::thread([this]{
+                try{
+                    compress();
+                } catch (...) {
+                    error = std::current_exception();
+                    //Let the writer go on without waiting (its output is lost)
+                    blocks.close();
+                    std::vector<char> b;
+                    while(blocks.pop(b))
+                        ;
+                }
+            });
+        }
+
+        ~compress_buf(){
+            try{
+                close();
+            } catch (...) {}
+        }
+
+        //Writes the rest of the output, and throws if anything could not be written
+        void close(){
+            if(closed)
+                return;
+            closed = true;
+
+            hand_over();
+            blocks.close();
+            worker.join();
+            if(::close(fd) != 0 && !error)
+                throw std::runtime_error(std::string("ERROR: could not write output: ") + std::strerror(errno));
+            if(error)
+                std::rethrow_exception(error);
+        }
+    };
+}
+
+/**
+ * @brief An ostream that writes to a file, compressed with gzip or zstd (or not at
+ * all) in a separate thread.
+ */
+class compressed_ostream : public std::ostream {
+private:
+    detail::compress_buf& compress_buf(){
+        return *( static_cast<detail::compress_buf*>(rdbuf()) );
+    }
+
+    static int open_output(const std::string& path){
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(fd < 0)
+            throw std::runtime_error("ERROR: could not open " + path + ": " + std::strerror(errno));
+        return fd;
+    }
+
+public:
+    //Opens the file at path, compressed according to its extension (see codec_for_path)
+    explicit compressed_ostream(const std::string& path)
+    : compressed_ostream(path, codec_for_path(path)) {};
+
+    compressed_ostream(const std::string& path, codec c)
+    : std::ostream(nullptr)
+    {
+        require_codec(c);
+        rdbuf(new detail::compress_buf(open_output(path), c));
+    }
+
+    virtual ~compressed_ostream(){
+        delete &compress_buf();
+    }
+
+    /**
+     * @brief Writes and closes the file. Throws if anything could not be written.
+     */
+    void close(){
+        compress_buf().close();
+    }
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef DELIM_SCANNER_H
+#define DELIM_SCANNER_H
+
+#include <array>
+#include <string_view>
+#include <stdexcept>
+#include <cstdint>
+
+#if !defined(MULTIBRACKET_NO_SIMD) && defined(__AVX2__)
+    #include <immintrin.h>
+    #define DELIM_SCANNER_AVX2
+#elif !defined(MULTIBRACKET_NO_SIMD) && defined(__SSE2__)
+    #include <emmintrin.h>
+    #define DELIM_SCANNER_SSE2
+#endif
+
+/**
+ * @brief Character classifier for a fixed set of delimiters, ending characters
+ * and parentheses, which finds the next character of interest in a string.
+ *
+ * The classification is a 256-entry table built once per set (at compile time,
+ * if the scanner is @c constexpr). Parentheses are given as in @c split: character
+ * 2n of @p par is a left parenthesis and 2n+1 the matching right one. A character
+ * that is both a parenthesis and a delimiter or ending character counts as a
+ * parenthesis only.
+ *
+ * When compiled with SSE2 or AVX2 support (and without @c MULTIBRACKET_NO_SIMD),
+ * runs of ordinary characters are skipped 16 or 32 bytes at a time, provided
+ * that there are at most @c max_simd_special characters of interest. The result
+ * is always the same as that of @c next_scalar.
+ */
+class delim_scanner {
+public:
+    enum : uint8_t {
+        ordinary    = 0,
+        delim       = 1 << 0,
+        end         = 1 << 1,
+        left_par    = 1 << 2,
+        right_par   = 1 << 3
+    };
+
+    static constexpr size_t max_pairs = 8;
+    static constexpr size_t max_simd_special = 8;
+
+private:
+    std::array<uint8_t, 256> cls;
+    std::array<uint8_t, 256> pair;      //index of the parenthesis pair
+    std::array<char, 256> special;      //all characters of interest
+    size_t n_special;
+    size_t n_pairs;
+
+    constexpr void add_special(char c){
+        for(size_t i = 0; i < n_special; i++){
+            if(special[i] == c)
+                return;
+        }
+        special[n_special++] = c;
+    }
+
+public:
+    constexpr delim_scanner(std::string_view delims, std::string_view par = "()[]{}",
+                            std::string_view ends = "")
+    : cls(), pair(), special(), n_special(0), n_pairs(par.length() / 2)
+    {
+        if(par.length() % 2)
+            throw std::runtime_error("ERROR: par must consist of matching pairs");
+        if(n_pairs > max_pairs)
+            throw std::runtime_error("ERROR: too many kinds of parentheses");
+
+        for(char c : delims){
+            cls[uint8_t(c)] |= delim;
+            add_special(c);
+        }
+        for(char c : ends){
+            cls[uint8_t(c)] |= end;
+            add_special(c);
+        }
+        for(size_t i = 0; i < par.length(); i++){
+            uint8_t c = uint8_t(par[i]);
+            cls[c] = (i % 2) ? right_par : left_par;
+            pair[c] = uint8_t(i / 2);
+            add_special(par[i]);
+        }
+    }
+
+    constexpr uint8_t classify(char c) const {
+        return cls[uint8_t(c)];
+    }
+    constexpr size_t pair_index(char c) const {
+        return pair[uint8_t(c)];
+    }
+    constexpr size_t pairs() const {
+        return n_pairs;
+    }
+
+    /**
+     * @brief Returns the position of the first character of interest in @p s
+     * at or after @p pos, or the length of @p s if there is none.
+     */
+    size_t next_scalar(std::string_view s, size_t pos) const {
+        while(pos < s.length() && cls[uint8_t(s[pos])] == ordinary)
+            pos++;
+        return pos;
+    }
+
+    /**
+     * @brief Same as @c next_scalar, but vectorised where possible.
+     */
+    size_t next(std::string_view s, size_t pos) const {
+#if defined(DELIM_SCANNER_AVX2)
+        if(n_special <= max_simd_special){
+            for(; pos + 32 <= s.length(); pos += 32){
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s.data() + pos));
+                __m256i m = _mm256_setzero_si256();
+                for(size_t i = 0; i < n_special; i++)
+                    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(special[i])));
+
+                uint32_t mask = uint32_t(_mm256_movemask_epi8(m));
+                if(mask)
+                    return pos + __builtin_ctz(mask);
+            }
+        }
+#elif defined(DELIM_SCANNER_SSE2)
+        if(n_special <= max_simd_special){
+            for(; pos + 16 <= s.length(); pos += 16){
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + pos));
+                __m128i m = _mm_setzero_si128();
+                for(size_t i = 0; i < n_special; i++)
+                    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(special[i])));
+
+                uint32_t mask = uint32_t(_mm_movemask_epi8(m));
+                if(mask)
+                    return pos + __builtin_ctz(mask);
+            }
+        }
+#endif
+        return next_scalar(s, pos);
+    }
+};
+
+#endif
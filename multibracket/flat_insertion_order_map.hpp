@@ -0,0 +1,336 @@
+#ifndef FLAT_INSERTION_ORDER_MAP_H
+#define FLAT_INSERTION_ORDER_MAP_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+
+namespace detail {
+
+    /*
+     * Default hash of flat_insertion_order_map. Strings and string views hash
+     * the same (as guaranteed by the standard library), so lookups by a
+     * std::string_view need not construct a std::string.
+     */
+    template< typename KeyT >
+    struct flat_map_hash : std::hash<KeyT> {};
+
+    template<>
+    struct flat_map_hash<std::string> {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+    };
+
+    template<>
+    struct flat_map_hash<std::string_view> {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+    };
+}
+
+/**
+ * @brief Map type where elements are ordered by the chronological order in which
+ * they are inserted, stored contiguously.
+ *
+ * @tparam KeyT the type of the keys
+ * @tparam MappedT the type of the mapped values
+ * @tparam Hash the hash object used to hash the keys; defaults to @c std::hash<KeyT>,
+ *      except for strings where a hash that also accepts @c std::string_view is used.
+ * @tparam Allocator the allocator used to allocate values;
+ *      defaults to @c std::allocator<value_type> where @c value_type is a key-value pair.
+ *
+ * This has the same interface and iteration order as @c insertion_order_map, but
+ * instead of a linked list and a node-based hash map, it keeps the elements in a
+ * vector and indexes them through an open-addressing table of 32-bit positions
+ * in that vector. Each element is a single allocation-free entry, and each key is
+ * stored once. If the hash is transparent (has an @c is_transparent member),
+ * lookup also works with any key-like type it accepts, such as a
+ * @c std::string_view for string keys.
+ *
+ * The differences from @c insertion_order_map are that insertion invalidates
+ * iterators (as for a vector), erasing is linear in the size of the map, and the
+ * elements are @c std::pair<KeyT, MappedT> whose keys must not be modified.
+ */
+template<
+    typename KeyT,
+    typename MappedT,
+    class Hash = detail::flat_map_hash<KeyT>,
+    class Allocator = std::allocator< std::pair<KeyT, MappedT> >
+>
+class flat_insertion_order_map {
+public:
+    using key_type                  = KeyT;
+    using mapped_type               = MappedT;
+    using value_type                = std::pair<key_type, mapped_type>;
+    using size_type                 = std::size_t;
+    using allocator_type            = Allocator;
+    using reference                 = mapped_type&;
+    using const_reference           = const mapped_type&;
+    using pointer                   = typename std::allocator_traits<allocator_type>::pointer;
+    using const_pointer             = typename std::allocator_traits<allocator_type>::const_pointer;
+
+private:
+    template< typename T >
+    using rebind = typename std::allocator_traits<allocator_type>::template rebind_alloc<T>;
+
+    using key_val_vector = typename std::vector< value_type, rebind<value_type> >;
+
+public:
+    using iterator                  = typename key_val_vector::iterator;
+    using const_iterator            = typename key_val_vector::const_iterator;
+    using reverse_iterator          = typename key_val_vector::reverse_iterator;
+    using const_reverse_iterator    = typename key_val_vector::const_reverse_iterator;
+
+private:
+    //Slots hold 1 + the position of an element, or 0 if empty
+    using slot_type = uint32_t;
+    static constexpr size_type min_slots = 8;
+
+    key_val_vector elements;
+    std::vector< size_t, rebind<size_t> > hashes;       //hash of each element
+    std::vector< slot_type, rebind<slot_type> > slots;  //size is zero or a power of two
+    Hash hasher;
+
+    template< typename H, typename = void >
+    struct is_transparent : std::false_type {};
+    template< typename H >
+    struct is_transparent< H, std::void_t<typename H::is_transparent> > : std::true_type {};
+
+    template< typename K >
+    using if_transparent = std::enable_if_t< is_transparent<Hash>::value
+                                             && !std::is_convertible_v<const K&, const_iterator>, int >;
+
+    //Finds the slot holding key, or the empty slot where it would go
+    template< typename K >
+    size_type probe(const K& key, size_t h) const {
+        size_type mask = slots.size() - 1;
+        for(size_type i = h & mask;; i = (i + 1) & mask){
+            slot_type s = slots[i];
+            if(s == 0 || (hashes[s - 1] == h && elements[s - 1].first == key))
+                return i;
+        }
+    }
+
+    template< typename K >
+    size_type index_of(const K& key) const {
+        if(elements.empty())
+            return elements.size();
+
+        slot_type s = slots[ probe(key, hasher(key)) ];
+        return s == 0 ? elements.size() : s - 1;
+    }
+
+    //Rebuilds the table with room for at least n elements at load factor 1/2
+    void rehash(size_type n){
+        size_type n_slots = min_slots;
+        while(n_slots < 2 * n)
+            n_slots *= 2;
+
+        slots.assign(n_slots, 0);
+        size_type mask = n_slots - 1;
+        for(size_type e = 0; e < elements.size(); e++){
+            size_type i = hashes[e] & mask;
+            while(slots[i] != 0)
+                i = (i + 1) & mask;
+            slots[i] = slot_type(e + 1);
+        }
+    }
+
+    //Appends an element whose key is known to be absent, given the slot from probe()
+    template< typename K, typename V >
+    iterator append(size_type slot, size_t h, K&& key, V&& val){
+        if(2 * (elements.size() + 1) > slots.size()){
+            elements.emplace_back(std::forward<K>(key), std::forward<V>(val));
+            hashes.push_back(h);
+            rehash(elements.size());
+        }
+        else{
+            elements.emplace_back(std::forward<K>(key), std::forward<V>(val));
+            hashes.push_back(h);
+            slots[slot] = slot_type(elements.size());
+        }
+        return --elements.end();
+    }
+
+    template< typename K, typename V >
+    std::pair<iterator, bool> insert_impl(K&& key, V&& val){
+        size_t h = hasher(key);
+        size_type slot = 0;
+        if(!slots.empty()){
+            slot = probe(key, h);
+            if(slots[slot] != 0)
+                return std::make_pair(elements.begin() + (slots[slot] - 1), false);
+        }
+        return std::make_pair(append(slot, h, std::forward<K>(key), std::forward<V>(val)), true);
+    }
+
+public:
+    /* Constructors, destructors and assignment */
+    flat_insertion_order_map(const flat_insertion_order_map&) = default;
+    flat_insertion_order_map(flat_insertion_order_map&&) = default;
+
+    ~flat_insertion_order_map() = default;
+
+    explicit flat_insertion_order_map(const allocator_type& a = allocator_type())
+    : elements(a), hashes(a), slots(a), hasher() {};
+
+    flat_insertion_order_map(std::initializer_list<value_type> il, const allocator_type& a = allocator_type())
+    : flat_insertion_order_map(a){
+        insert(il);
+    }
+    template <typename FwdIter>
+    flat_insertion_order_map(FwdIter first, FwdIter last, const allocator_type& a = allocator_type())
+    : flat_insertion_order_map(a){
+        insert(first, last);
+    }
+
+    flat_insertion_order_map& operator= (const flat_insertion_order_map&) = default;
+    flat_insertion_order_map& operator= (flat_insertion_order_map&&) = default;
+
+    /* Selectors */
+    const_iterator find(const key_type& key) const {
+        return elements.begin() + index_of(key);
+    }
+    template< typename K, if_transparent<K> = 0 >
+    const_iterator find(const K& key) const {
+        return elements.begin() + index_of(key);
+    }
+    size_type count(const key_type& key) const {
+        return index_of(key) != elements.size();
+    }
+    template< typename K, if_transparent<K> = 0 >
+    size_type count(const K& key) const {
+        return index_of(key) != elements.size();
+    }
+    size_type size() const {
+        return elements.size();
+    }
+    size_type max_size() const {
+        return std::min( elements.max_size(), size_type(UINT32_MAX / 2) );
+    }
+    bool empty() const {
+        return elements.empty();
+    }
+    const_reference at(const key_type& key) const {
+        size_type i = index_of(key);
+        if(i == elements.size())
+            throw std::out_of_range("flat_insertion_order_map::at");
+        return elements[i].second;
+    }
+
+    allocator_type get_allocator()  {
+        return elements.get_allocator();
+    }
+
+    /* Mutators */
+    iterator find(const key_type& key){
+        return elements.begin() + index_of(key);
+    }
+    template< typename K, if_transparent<K> = 0 >
+    iterator find(const K& key){
+        return elements.begin() + index_of(key);
+    }
+    reference at(const key_type& key){
+        size_type i = index_of(key);
+        if(i == elements.size())
+            throw std::out_of_range("flat_insertion_order_map::at");
+        return elements[i].second;
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value){
+        return insert_impl(value.first, value.second);
+    }
+    std::pair<iterator, bool> insert(value_type&& value){
+        return insert_impl(std::move(value.first), std::move(value.second));
+    }
+    template< typename P, typename = std::enable_if_t< std::is_constructible_v<value_type, P&&> > >
+    std::pair<iterator, bool> insert(P&& value){
+        return insert(value_type(std::forward<P>(value)));
+    }
+    template< typename InputIt >
+    void insert(InputIt first, InputIt last){
+        for(; first != last; ++first)
+            insert_impl(first->first, first->second);
+    }
+    void insert(std::initializer_list<value_type> ilist){
+        insert(ilist.begin(), ilist.end());
+    }
+    template< class... Args >
+    std::pair<iterator, bool> emplace( Args&&... args ){
+        return insert(value_type(std::forward<Args>(args)...));
+    }
+
+    //Hinted insertion is pointless, but included for compatibility
+    iterator insert(const_iterator hint, const value_type& value){  return insert(value).first; }
+    iterator insert(const_iterator hint, value_type&& value){       return insert(std::move(value)).first; }
+    template <class... Args>
+    iterator emplace_hint( const_iterator hint, Args&&... args ){   return emplace(std::forward<Args>(args)...).first;}
+
+    reference operator[] (const key_type& key){
+        return insert_impl(key, mapped_type()).first->second;
+    }
+    //With a transparent hash, a key_type is only constructed if the key is absent
+    template< typename K, if_transparent<K> = 0 >
+    reference operator[] (const K& key){
+        size_t h = hasher(key);
+        if(!slots.empty()){
+            size_type slot = probe(key, h);
+            if(slots[slot] != 0)
+                return elements[slots[slot] - 1].second;
+            return append(slot, h, key_type(key), mapped_type())->second;
+        }
+        return append(0, h, key_type(key), mapped_type())->second;
+    }
+
+    size_type erase(const key_type& key){
+        size_type i = index_of(key);
+        if(i == elements.size())
+            return 0;
+
+        erase(elements.begin() + i);
+        return 1;
+    }
+    iterator erase(const_iterator pos){
+        return erase(pos, pos + 1);
+    }
+    iterator erase(const_iterator first, const_iterator last){
+        size_type i = first - elements.cbegin(), j = last - elements.cbegin();
+        hashes.erase(hashes.begin() + i, hashes.begin() + j);
+        iterator it = elements.erase(first, last);
+        rehash(elements.size());
+        return it;
+    }
+
+    void clear(){
+        elements.clear();
+        hashes.clear();
+        slots.clear();
+    }
+
+    void reserve(size_type n){
+        elements.reserve(n);
+        hashes.reserve(n);
+        //Never fewer slots than the elements already there need
+        rehash(std::max(n, elements.size()));
+    }
+
+    iterator begin()                { return elements.begin();      }
+    iterator end()                  { return elements.end();        }
+    const_iterator begin()  const   { return elements.begin();      }
+    const_iterator end()    const   { return elements.end();        }
+    const_iterator cbegin() const   { return elements.cbegin();     }
+    const_iterator cend()   const   { return elements.cend();       }
+    reverse_iterator rbegin()                { return elements.rbegin();      }
+    reverse_iterator rend()                  { return elements.rend();        }
+    const_reverse_iterator rbegin()  const   { return elements.rbegin();      }
+    const_reverse_iterator rend()    const   { return elements.rend();        }
+    const_reverse_iterator crbegin() const   { return elements.crbegin();     }
+    const_reverse_iterator crend()   const   { return elements.crend();       }
+
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef FOLLOW_READER_H
+#define FOLLOW_READER_H
+
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+/**
+ * @brief Reads a file that is still being written, like <tt>tail -f</tt>.
+ *
+ * @c read() returns what has been appended to the file since the last call, and
+ * when there is nothing new, calls the idle function (to flush output) and waits
+ * until there is. Changes are watched for with inotify, and if that is not
+ * available, by polling the file a few times per second; inotify is also backed
+ * up by an occasional poll, in case an event is missed.
+ *
+ * Following ends (and @c read() returns 0, as at the end of a file) once
+ * @c stop() has been called, which is safe to do from a signal handler, until
+ * @c restart() is called. A file that shrinks is reported by throwing
+ * @c std::runtime_error, since what was already read of it no longer means
+ * anything.
+ */
+class follow_reader {
+public:
+    using idle_function = std::function<void()>;
+
+private:
+    static constexpr int poll_ms = 250;             //without inotify
+    static constexpr int backup_poll_ms = 2000;     //with inotify
+
+    static volatile std::sig_atomic_t& stopped(){
+        static volatile std::sig_atomic_t flag = 0;
+        return flag;
+    }
+
+    std::string path;
+    int fd;
+    int watch_fd;           //inotify instance, or -1
+    uint64_t offset;        //bytes read so far
+    idle_function idle;
+
+    //Waits for the file to change (or a timeout, or a signal)
+    void wait(){
+        if(watch_fd < 0){
+            ::poll(nullptr, 0, poll_ms);
+            return;
+        }
+
+        struct pollfd p = { watch_fd, POLLIN, 0 };
+        if(::poll(&p, 1, backup_poll_ms) > 0){
+            //Only that something happened matters, not what
+            char events[4096];
+            while(::read(watch_fd, events, sizeof(events)) > 0)
+                ;
+        }
+    }
+
+public:
+    /**
+     * @brief Opens the file at @p p, to be read from its start.
+     */
+    follow_reader(const std::string& p, idle_function f)
+    : path(p), fd(::open(p.c_str(), O_RDONLY)), watch_fd(-1), offset(0), idle(f)
+    {
+        if(fd < 0)
+            throw std::runtime_error("ERROR: could not open " + path);
+
+        watch_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(watch_fd >= 0 && ::inotify_add_watch(watch_fd, path.c_str(),
+                                                IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE) < 0){
+            ::close(watch_fd);
+            watch_fd = -1;
+        }
+    }
+
+    follow_reader(const follow_reader&) = delete;
+    follow_reader& operator= (const follow_reader&) = delete;
+
+    ~follow_reader(){
+        if(watch_fd >= 0)
+            ::close(watch_fd);
+        ::close(fd);
+    }
+
+    //Makes every follow_reader end at the next read() that finds nothing new
+    static void stop(){
+        stopped() = 1;
+    }
+
+    //Undoes stop(), for following again after an earlier stop
+    static void restart(){
+        stopped() = 0;
+    }
+
+    /**
+     * @brief Reads up to @p n bytes of what has been appended to the file, waiting
+     * for more if there is nothing yet. Returns 0 only once stopped.
+     */
+    size_t read(char* buf, size_t n){
+        for(bool waited = false; ; waited = true){
+            ssize_t got = ::pread(fd, buf, n, off_t(offset));
+            if(got > 0){
+                offset += got;
+                return size_t(got);
+            }
+            if(got < 0){
+                if(errno == EINTR)
+                    continue;
+                throw std::runtime_error("ERROR: could not read " + path + ": " + std::strerror(errno));
+            }
+
+            struct stat st;
+            if(::fstat(fd, &st) == 0 && uint64_t(st.st_size) < offset)
+                throw std::runtime_error("ERROR: " + path + " was truncated while following it");
+            if(stopped())
+                return 0;
+
+            if(!waited && idle)
+                idle();
+            wait();
+        }
+    }
+};
+
+#endif
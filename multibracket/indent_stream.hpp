@@ -2,62 +2,205 @@
 #define INDENT_STREAM_H
 
 #include <iostream>
-#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
 
 
 namespace detail {
 
-    class indent_buf : public std::stringbuf {
+    /*
+     * Stream buffer behind indent_stream. Text written to it is kept in a
+     * pending area until the next sync() or paragraph(), at which point it is
+     * laid out using the indentation in effect at that time: the text is cut
+     * into whole line segments at linebreaks and at the maximum depth, and each
+     * segment and indent is copied in one go into an output buffer, which is
+     * written to the underlying stream when full or on sync().
+     *
+     * Marks can be placed in the pending text; when it is laid out, each mark
+     * is given the offset in the output (and the number of linebreaks before it)
+     * of the character that follows it.
+     */
+    class indent_buf : public std::streambuf {
     private:
+        static constexpr size_t pending_size = size_t(1) << 12;
+        static constexpr size_t output_size = size_t(1) << 18;
         
         std::ostream& out;
         
         size_t depth;
         size_t indent_level;
         
+        std::vector<char> pending;
+        std::vector<char> output;
+        size_t output_len;
+        std::string pad;
+        
+        struct mark_entry {
+            size_t offset;          //in the pending text, until resolved
+            uint64_t position;
+            uint64_t line;
+        };
+        std::vector<mark_entry> marks;
+        size_t n_resolved;          //marks before this one have been laid out
+        uint64_t first_mark;        //ID of marks[0]
+        uint64_t written;           //bytes output so far
+        uint64_t lines;             //linebreaks output so far
+        
+        void emit(const char* s, size_t n){
+            written += n;
+            if(output_len + n > output.size()){
+                flush_output();
+                if(n > output.size()){
+                    out.write(s, n);
+                    return;
+                }
+            }
+            std::memcpy(output.data() + output_len, s, n);
+            output_len += n;
+        }
+        
+        void flush_output(){
+            out.write(output.data(), output_len);
+            output_len = 0;
+        }
+        
         void indent_line(bool par = false){
             depth = (par ? par_indent : basic_indent) + indent_level*indent_step;
                     
             if(depth > max_depth)
                 throw std::runtime_error("ERROR: indent larger than maximum depth");
             
-            out << std::string(depth, ' ');
+            if(pad.length() < depth)
+                pad.assign(max_depth, ' ');
+            emit(pad.data(), depth);
         }
-    public:
         
-        size_t max_depth;
-        size_t par_indent;
-        size_t basic_indent;
-        size_t indent_step;
+        void emit_linebreak(){
+            emit("\n", 1);
+            lines++;
+        }
         
-        indent_buf(std::ostream& o = std::cout, size_t ind = 0) : out(o), indent_level(ind) {};
+        //Resolves the marks before the pending offset end, given that the text from
+        //the offset begin on is about to be output verbatim
+        void resolve_marks(size_t begin, size_t end){
+            for(; n_resolved < marks.size() && marks[n_resolved].offset < end; n_resolved++){
+                mark_entry& m = marks[n_resolved];
+                m.position = written + (m.offset > begin ? m.offset - begin : 0);
+                m.line = lines;
+            }
+        }
         
-        virtual int sync(){
-            std::string s = str();
+        //Lays out the pending text
+        void layout(){
+            const char* p = pbase();
+            const char* e = pptr();
             
-            for(size_t i = 0; i < s.length(); i++){
-                if(depth > max_depth || s[i] == '\n'){
-                    out.put('\n');
+            while(p < e){
+                //Number of characters that fit before the line must be broken
+                size_t room = depth <= max_depth ? max_depth + 1 - depth : 0;
+                size_t n = std::min(room, size_t(e - p));
+                
+                const char* nl = static_cast<const char*>(std::memchr(p, '\n', n));
+                if(nl){
+                    resolve_marks(p - pbase(), nl + 1 - pbase());
+                    emit(p, nl - p);
+                    emit_linebreak();
                     indent_line();
-                    
-                    if(s[i] == '\n')
-                        continue;
-                }  
+                    p = nl + 1;
+                    continue;
+                }
                 
-                out.put(s[i]);
-                depth++;
+                resolve_marks(p - pbase(), p + n - pbase());
+                emit(p, n);
+                depth += n;
+                p += n;
                 
+                //Line is full: break it, absorbing a linebreak that comes right after
+                if(p < e){
+                    emit_linebreak();
+                    indent_line();
+                    if(*p == '\n')
+                        p++;
+                }
             }
+            resolve_marks(e - pbase(), e + 1 - pbase());
+            
+            setp(pending.data(), pending.data() + pending.size());
+        }
+        
+    protected:
+        virtual int_type overflow(int_type c){
+            //Text is only laid out on sync() or paragraph(), so grow the pending area
+            size_t len = pptr() - pbase();
+            pending.resize(2 * pending.size());
+            setp(pending.data(), pending.data() + pending.size());
+            pbump(int(len));
             
-            str("");        
+            if(!traits_type::eq_int_type(c, traits_type::eof())){
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+        
+    public:
+        
+        size_t max_depth;
+        size_t par_indent;
+        size_t basic_indent;
+        size_t indent_step;
+        
+        indent_buf(std::ostream& o = std::cout, size_t ind = 0) 
+        : out(o), depth(0), indent_level(ind), pending(pending_size), output(output_size), 
+          output_len(0), pad(), marks(), n_resolved(0), first_mark(0), written(0), lines(0)
+        {
+            setp(pending.data(), pending.data() + pending.size());
+        };
+        
+        virtual int sync(){
+            layout();
+            flush_output();
+            return 0;
         }
         
         void paragraph(){
-            sync();
-            out.put('\n');
+            layout();
+            emit_linebreak();
             indent_line(true);
         }
         
+        void set_column(size_t col){
+            depth = col;
+        }
+        
+        void advance(size_t n){
+            written += n;
+        }
+        
+        uint64_t mark(){
+            marks.push_back(mark_entry{size_t(pptr() - pbase()), 0, 0});
+            return first_mark + marks.size() - 1;
+        }
+        bool resolved(uint64_t id) const {
+            return id < first_mark + n_resolved;
+        }
+        uint64_t mark_position(uint64_t id) const {
+            return marks[id - first_mark].position;
+        }
+        uint64_t mark_line(uint64_t id) const {
+            return marks[id - first_mark].line;
+        }
+        void release_marks(){
+            marks.erase(marks.begin(), marks.begin() + n_resolved);
+            first_mark += n_resolved;
+            n_resolved = 0;
+        }
+        
         void incr_indent(size_t incr){
             indent_level += incr;
         }
@@ -88,6 +231,11 @@ namespace detail {
  * a number of spaces that always appears to the left regardless of the indent
  * level (default: 0).
  * 
+ * Output is buffered, and only reaches the underlying ostream when the indent
+ * stream is flushed. To find where a piece of text ends up in the output, call
+ * @c mark before writing it: once the text is laid out (on the next @c paragraph
+ * or flush), @c mark_position gives its offset from the start of the output.
+ * 
  * This class has no way to guard against independent use of the underlying
  * ostream, and will not behave correctly in that case. Currently, it does not 
  * handle tabs and non-printable characters correctly. 
@@ -123,6 +271,40 @@ public:
         indent_buf().paragraph();   
         return *this; 
     }
+    //Tells the stream where the current line stands after text was written to
+    //the underlying stream directly (before any text that is still buffered),
+    //so that lines are still broken in time
+    indent_stream& set_column(size_t col){
+        indent_buf().set_column(col);
+        return *this;
+    }
+    //Counts n bytes written to the underlying stream directly in the offsets of marks
+    indent_stream& advance(size_t n){
+        indent_buf().advance(n);
+        return *this;
+    }
+    
+    //Places a mark before the next character written, and returns its ID
+    uint64_t mark(){
+        return indent_buf().mark();
+    }
+    //Whether the text at a mark has been laid out, so that its position is known
+    bool resolved(uint64_t id) const {
+        return indent_buf().resolved(id);
+    }
+    //Offset in the output of the character after a resolved mark
+    uint64_t mark_position(uint64_t id) const {
+        return indent_buf().mark_position(id);
+    }
+    //Number of linebreaks in the output before a resolved mark
+    uint64_t mark_line(uint64_t id) const {
+        return indent_buf().mark_line(id);
+    }
+    //Forgets all resolved marks. Their IDs must not be used afterwards.
+    indent_stream& release_marks(){
+        indent_buf().release_marks();
+        return *this;
+    }
     indent_stream& incr_indent(size_t incr = 1){ 
         indent_buf().incr_indent(incr); 
         return *this; 
@@ -50,7 +50,8 @@ public:
     using const_reverse_iterator    = typename key_val_list::const_reverse_iterator;
     
 private:
-    using key_iter_map = typename std::unordered_map< key_type, iterator >;
+    using key_iter_map = typename std::unordered_map< key_type, iterator, Hash, std::equal_to<key_type>,
+        typename std::allocator_traits<allocator_type>::template rebind_alloc< std::pair<const key_type, iterator> > >;
     
 private:
     key_val_list elements;
@@ -64,16 +65,16 @@ public:
     ~insertion_order_map() = default;
     
     explicit insertion_order_map(const allocator_type& a = allocator_type()) 
-    : elements(a), map() {};
+    : elements(a), map(a) {};
     
     insertion_order_map(std::initializer_list<value_type> il, const allocator_type& a = allocator_type()) 
-    : elements(il, a), map(){
+    : elements(il, a), map(a){
         for(iterator it = elements.begin(); it != elements.end(); ++it)
             map[ it->first ] = it;
     }
     template <typename FwdIter>
     insertion_order_map(FwdIter first, FwdIter last, const allocator_type& a = allocator_type()) 
-    : elements(first, last, a), map(){
+    : elements(first, last, a), map(a){
         for(iterator it = elements.begin(); it != elements.end(); ++it)
             map[ it->first ] = it;
     }
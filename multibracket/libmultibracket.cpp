@@ -0,0 +1,2931 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <memory>
+#include <thread>
+#include <exception>
+#include <atomic>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <csignal>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "flat_insertion_order_map.hpp"
+#include "indent_stream.hpp"
+#include "line_reader.hpp"
+#include "arena.hpp"
+#include "delim_scanner.hpp"
+#include "spec_cache.hpp"
+#include "spsc_queue.hpp"
+#include "work_pool.hpp"
+#include "run_stats.hpp"
+#include "symbol_interner.hpp"
+#include "symbol_classifier.hpp"
+#include "term_lexer.hpp"
+#include "tree_writer.hpp"
+#include "output_index.hpp"
+#include "codec.hpp"
+#include "spill_file.hpp"
+#include "follow_reader.hpp"
+#include "multibracket.hpp"
+
+//Multibracket tag (special symbol output by FORM macro)
+#define MULTIBRACKET_TAG "[_MB_]"
+#define MULTIBRACKET "       + " MULTIBRACKET_TAG
+
+//Everything but the library interface (see multibracket.hpp) is internal to the library
+namespace {
+
+using view_list = typename std::vector<std::string_view>;
+using content_list = typename std::vector< std::string_view, arena_allocator<std::string_view> >;
+
+/* 
+ * Splits a string s at all occurrences of any of the characters in delim,
+ * except when they occur between (possibly nested) parentheses. The string
+ * is considered to start at pos, and pos is left as the index of the last
+ * character considered by the method (or as past-the-end).
+ * 
+ * Parentheses are specified through par, in which character 2n is a left
+ * parenthesis, and character 2n+1 is the corresponding right parenthesis
+ * (default: "()[]{}"). Parentheses must be matched, but they may be interleaved
+ * (e.g. "[(])"). This method doesn't care about mismatched parentheses.
+ * 
+ * The method terminates when it reaches the end of the string, or any
+ * of the characters in end (default: ""), or when a right parenthesis is found
+ * without a corresponding left parenthesis. Like delim, end is ignored
+ * inside parentheses.
+ * 
+ * Empty substrings are ignored. The substrings are views into s.
+ * 
+ * The characters are classified by a delim_scanner, which may also be built
+ * once and passed directly if the same sets are used repeatedly.
+ */
+view_list split(std::string_view s, size_t& pos, const delim_scanner& scanner){
+    view_list split;
+    
+    bool add_sub = false, done = false;
+    std::array<size_t, delim_scanner::max_pairs> par_count{};
+    size_t n_open = 0;      //total number of open parentheses
+    size_t prev = pos;
+
+    for(;; pos++){
+        //Treat a single character, sett add_sub = true if it is time to add a new substring
+        //to the list, and done = true if it is time to terminate the function after adding the
+        //final substring. Characters that are neither parentheses nor delimiters nor ending
+        //characters are skipped.
+        pos = scanner.next(s, pos);
+        
+        if(pos >= s.length()){
+            done = true;
+        }
+        else{
+            uint8_t cls = scanner.classify(s[pos]);
+            size_t idx = scanner.pair_index(s[pos]);
+            
+            if(cls & delim_scanner::right_par){
+                if(par_count[idx] == 0){    //final closing paren
+                    done = true;
+                }
+                else{   //just decrement
+                    par_count[idx]--;
+                    n_open--;
+                }
+            }
+            else if(cls & delim_scanner::left_par){
+                par_count[idx]++;
+                n_open++;
+            }
+            else if(n_open == 0){    //not parenthesised, look for end or delim
+                if(cls & delim_scanner::end){
+                    done = true;
+                }
+                if(cls & delim_scanner::delim){
+                    //done = false;
+                    add_sub = true;
+                }
+            }
+        }
+                
+        if(add_sub || done){
+            std::string_view sub = s.substr(prev, pos-prev);
+            //Ignore empty substrings
+            if(!sub.empty())
+                split.push_back(sub);
+            
+            prev = pos+1;
+            if(done)
+                return split;
+            
+            add_sub = false;
+        }
+    }
+}
+
+view_list split(std::string_view s, size_t& pos, 
+                std::string_view delim, 
+                std::string_view par = "()[]{}",
+                std::string_view end = ""
+               )
+{
+    return split(s, pos, delim_scanner(delim, par, end));
+}
+
+//Fixed character sets used when parsing terms (see also term_lexer)
+constexpr delim_scanner head_scanner("^(", "[]");
+constexpr delim_scanner broken_line_scanner("", "", "[]()#");
+
+bool is_plusminus(char c){
+    return c == '+' || c == '-';
+}
+
+//Reads until endchar (which must be ')' or '#', see broken_line_scanner) outside parentheses,
+//joining lines if necessary
+std::string read_broken_line(std::string_view& line, size_t& pos, char endchar, line_reader& in){
+    
+    //Move ahead to first non-space, assuming properly formatted input
+    size_t start = pos;
+    while(start < line.length() && std::isspace(line[start]))
+        start++;
+    
+    //Line is not actually broken, read new line and return empty string
+    if(start >= line.length()){
+        pos = 0;
+        in.getline(line);
+        
+        return "";
+    }
+    
+    std::string full_line = "";
+    
+    //Scan until closing parenthesis, skipping characters that are not
+    //parentheses, brackets or possible endchars
+    size_t par = 0, fpar = 0;
+    for(pos = start;; pos++){
+        pos = broken_line_scanner.next(line, pos);
+        
+        while(pos >= line.length()){
+                
+            full_line += line.substr(start);
+            if(!line.empty() && is_plusminus(line[line.length() - 1]))
+                full_line += ' ';
+            
+            //Read next line, skipping initial whitespace and assuming proper input
+            start = 0;
+            if(!in.getline(line))
+                throw std::runtime_error("ERROR: unexpected EOF in line \"" + full_line + "\"");
+            
+            while(start < line.length() && std::isspace(line[start]))
+                start++;
+            
+            if(start < line.length() && is_plusminus(line[start]))
+                full_line += ' ';
+            pos = broken_line_scanner.next(line, start);
+        }
+                
+        //Handle formal names
+        if(line[pos] == '[')
+            fpar++;
+        else if(line[pos] == ']')
+            fpar--;
+        //Handle parentheses, but only if not inside formal name
+        else if(fpar == 0){
+            if(par == 0 && line[pos] == endchar){
+                //Found the end!
+                //Complete the line without including the endchar,
+                //and leave pos pointing to it.
+                if(pos > start)
+                    full_line += line.substr(start, pos-1 - start);
+                return full_line;   
+            }            
+            else if(line[pos] == '(')
+                par++;
+            else if(line[pos] == ')')
+                par--;
+        }
+    }
+    
+}
+
+std::string_view symbol_head(std::string_view sym){
+    size_t pos = 0;
+    return split(sym, pos, head_scanner).front();
+}
+
+using symbol_id = symbol_interner::id_type;
+
+/*
+ * The key of a bracket on one level, as the IDs of its factors (in the order in
+ * which they appear in the term) and a hash of the sequence, computed once.
+ * The IDs are not owned by the key.
+ */
+struct symbol_key {
+    const symbol_id* ids = nullptr;
+    uint32_t n = 0;
+    size_t hash = 0;
+
+    bool empty() const {
+        return n == 0;
+    }
+
+    bool operator== (const symbol_key& o) const {
+        return hash == o.hash && n == o.n && std::equal(ids, ids + n, o.ids);
+    }
+
+    //The hash is that of the sequence, so the map can use it directly
+    struct hasher {
+        size_t operator()(const symbol_key& k) const {
+            return k.hash;
+        }
+    };
+
+    //Copies the IDs into mem, so that the key remains valid as long as it
+    symbol_key copy(arena& mem) const {
+        symbol_key k = *this;
+        symbol_id* p = static_cast<symbol_id*>(mem.allocate(n * sizeof(symbol_id), alignof(symbol_id)));
+        std::copy(ids, ids + n, p);
+        k.ids = p;
+        return k;
+    }
+};
+
+/*
+ * Reads the outside-the-bracket part of terms from a term_lexer, and sorts their
+ * factors into keys by level. Each distinct factor is interned once, and its level found (through
+ * its head) and remembered in its tag then, so that a term whose factors have
+ * all been seen before is sorted without any string hashing beyond the interner
+ * lookups, and without allocating.
+ *
+ * The keys returned by parse() remain valid until the next call.
+ */
+class key_parser {
+private:
+    //More distinct factors than this are forgotten by trim()
+    static constexpr size_t max_symbols = size_t(1) << 20;
+    
+    const symbol_classifier& classifier;
+    size_t n_level;
+    symbol_interner symbols;
+
+    std::vector< std::vector<symbol_id> > level_ids;
+    std::vector<symbol_key> keys;
+
+    //Level of a factor; symbols not in the classifier go to the last level
+    size_t level(symbol_id factor){
+        uint32_t& lvl = symbols.tag(factor);
+        if(lvl == symbol_interner::no_tag){
+            std::string_view head = symbol_head(symbols.text(factor));
+            uint32_t& head_lvl = symbols.tag(symbols.intern(head));
+            if(head_lvl == symbol_interner::no_tag)
+                head_lvl = uint32_t(classifier.level(head));
+            //Interning may have moved the factor's entry
+            symbols.tag(factor) = head_lvl;
+            return head_lvl;
+        }
+        return lvl;
+    }
+
+public:
+    explicit key_parser(const symbol_classifier& c)
+    : classifier(c), n_level(c.levels()), symbols(), level_ids(n_level + 1), keys(n_level + 1) {};
+
+    //Reads the factors of a term up to the opening parenthesis of its bracket, and returns
+    //its keys on each level (the last one holding unknown symbols), the empty key where
+    //the term has no factors on a level
+    const std::vector<symbol_key>& parse(term_lexer& lexer){
+        for(std::vector<symbol_id>& ids : level_ids)
+            ids.clear();
+
+        //The lexer returns nothing but factors before the opening parenthesis
+        while(lexer.next() == term_lexer::token::factor){
+            symbol_id id = symbols.intern(lexer.value());
+            level_ids[level(id)].push_back(id);
+        }
+
+        for(size_t lvl = 0; lvl <= n_level; lvl++){
+            const std::vector<symbol_id>& ids = level_ids[lvl];
+            size_t h = 0;
+            for(symbol_id id : ids)
+                h = (h + id + 1) * 0x9e3779b97f4a7c15ull;
+            keys[lvl] = symbol_key{ids.data(), uint32_t(ids.size()), h ^ (h >> 29)};
+        }
+        return keys;
+    }
+
+    std::string text(const symbol_key& k) const {
+        return symbols.join(k.ids, k.n);
+    }
+
+    std::string_view text(const symbol_key& k, arena& mem) const {
+        return symbols.join(k.ids, k.n, mem);
+    }
+
+    std::string_view factor(symbol_id id) const {
+        return symbols.text(id);
+    }
+    
+    //Forgets the factors seen so far if there are too many, so that they do not pile up
+    //over a long run. Only allowed when no keys from earlier calls are in use (e.g.
+    //between expressions), since their IDs are reused. Returns whether it did.
+    bool trim(){
+        if(symbols.size() <= max_symbols)
+            return false;
+        symbols.clear();
+        return true;
+    }
+};
+
+} //namespace
+
+/*
+ * The brackets selected with --select. Each selected path consists of patterns
+ * for the keys on successive levels, separated by '/'. A pattern is "*" (any key),
+ * "1" (no factors on that level) or a product of factor patterns, which matches
+ * a key with as many factors in the same order, each factor pattern matching the
+ * whole factor, with '*' standing for any sequence of characters (so "F(*)" is
+ * any factor with the head F). Levels after the end of a path are not restricted.
+ * A term is selected if its keys match any of the paths.
+ */
+class bracket_selection {
+private:
+    struct level_pattern {
+        bool any;
+        view_list factors;      //views into patterns
+    };
+    
+    std::vector<std::string> patterns;
+    std::vector< std::vector<level_pattern> > paths;
+    size_t n_levels;
+    
+    //Matches s against a pattern in which '*' stands for any sequence of characters
+    static bool glob(std::string_view p, std::string_view s){
+        size_t i = 0, j = 0;
+        size_t star = std::string_view::npos, resume = 0;
+        while(j < s.length()){
+            if(i < p.length() && p[i] == '*'){
+                star = i++;
+                resume = j;
+            }
+            else if(i < p.length() && p[i] == s[j]){
+                i++;
+                j++;
+            }
+            else if(star != std::string_view::npos){
+                i = star + 1;
+                j = ++resume;
+            }
+            else
+                return false;
+        }
+        while(i < p.length() && p[i] == '*')
+            i++;
+        return i == p.length();
+    }
+    
+public:
+    static constexpr size_t max_paths = 64;
+    
+    //Builds the selection for keys on n_level + 1 levels (including unknown symbols)
+    bracket_selection(const std::vector<std::string>& selected, size_t n_level)
+    : patterns(selected), paths(), n_levels(0)
+    {
+        if(patterns.size() > max_paths)
+            throw std::runtime_error("ERROR: more than " + std::to_string(max_paths) + " --select paths");
+        
+        for(const std::string& path : patterns){
+            size_t pos = 0;
+            view_list levels = split(path, pos, "/", "()[]");
+            if(levels.empty() || pos < path.length())
+                throw std::runtime_error("ERROR: malformed --select path \"" + path + "\"");
+            if(levels.size() > n_level + 1)
+                throw std::runtime_error("ERROR: --select path \"" + path + "\" has more levels than the brackets");
+            
+            paths.emplace_back();
+            for(std::string_view level : levels){
+                level_pattern lp{level == "*", view_list()};
+                if(!lp.any && level != "1"){
+                    size_t fpos = 0;
+                    lp.factors = split(level, fpos, "*", "()[]");
+                    
+                    //split() drops empty factors, as in "b*", where '*' was meant as a
+                    //wildcard but separates factors outside function arguments
+                    size_t length = lp.factors.size() - 1;
+                    for(std::string_view f : lp.factors)
+                        length += f.length();
+                    if(lp.factors.empty() || length != level.length())
+                        throw std::runtime_error("ERROR: empty factor in --select path \"" + path
+                                                 + "\" ('*' separates factors, except in function arguments)");
+                }
+                paths.back().push_back(lp);
+            }
+            n_levels = std::max(n_levels, levels.size());
+        }
+    }
+    
+    //paths refers to the patterns, which must therefore stay in place
+    bracket_selection(const bracket_selection&) = delete;
+    bracket_selection& operator= (const bracket_selection&) = delete;
+    
+    bool empty() const {
+        return paths.empty();
+    }
+    
+    //Number of levels restricted by some path
+    size_t levels() const {
+        return n_levels;
+    }
+    
+    //The set of all paths, as bits
+    uint64_t all() const {
+        return paths.size() == 64 ? ~uint64_t(0) : (uint64_t(1) << paths.size()) - 1;
+    }
+    
+    //Returns the set of paths (as bits) that allow a key with the given factors on a level
+    uint64_t matches(size_t level, const view_list& factors) const {
+        uint64_t result = 0;
+        for(size_t i = 0; i < paths.size(); i++){
+            bool match = true;
+            if(level < paths[i].size() && !paths[i][level].any){
+                const view_list& pattern = paths[i][level].factors;
+                match = (pattern.size() == factors.size());
+                for(size_t f = 0; match && f < factors.size(); f++)
+                    match = glob(pattern[f], factors[f]);
+            }
+            if(match)
+                result |= uint64_t(1) << i;
+        }
+        return result;
+    }
+};
+
+namespace {
+
+/*
+ * Applies a bracket_selection to the keys of terms from a key_parser. The paths
+ * allowed by each distinct key on each level are found once and remembered, so
+ * that most terms are decided with one lookup per restricted level.
+ */
+class key_selector {
+private:
+    //More distinct keys than this are forgotten by trim()
+    static constexpr size_t max_keys = size_t(1) << 20;
+    
+    const bracket_selection& selection;
+    std::vector< flat_insertion_order_map< symbol_key, uint64_t, symbol_key::hasher > > seen;
+    arena seen_ids;                 //IDs of the keys in seen
+    view_list factors;
+    
+public:
+    explicit key_selector(const bracket_selection& s)
+    : selection(s), seen(s.levels()), seen_ids(), factors() {};
+    
+    bool selected(const key_parser& keys, const std::vector<symbol_key>& br_keys){
+        uint64_t paths = selection.all();
+        for(size_t lvl = 0; lvl < seen.size() && paths != 0; lvl++){
+            const symbol_key& key = br_keys[lvl];
+            auto it = seen[lvl].find(key);
+            if(it == seen[lvl].end()){
+                factors.clear();
+                for(uint32_t i = 0; i < key.n; i++)
+                    factors.push_back(keys.factor(key.ids[i]));
+                it = seen[lvl].emplace(key.copy(seen_ids), selection.matches(lvl, factors)).first;
+            }
+            paths &= it->second;
+        }
+        return paths != 0;
+    }
+    
+    //Forgets the keys seen so far if there are too many, or if the key_parser has
+    //forgotten their IDs (see key_parser::trim())
+    void trim(bool forgotten){
+        size_t n = 0;
+        for(auto& keys : seen)
+            n += keys.size();
+        if(!forgotten && n <= max_keys)
+            return;
+        for(auto& keys : seen)
+            keys.clear();
+        seen_ids.release();
+    }
+};
+
+//The level of the key of the top-level sub-bracket that a term goes into, which is
+//the first nonempty one; if all are empty, the last one (whose empty key refers to
+//the content of the root)
+size_t top_level(const std::vector<symbol_key>& br_keys){
+    size_t top = 0;
+    while(top < br_keys.size() - 1 && br_keys[top].empty())
+        top++;
+    return top;
+}
+
+/*
+ * State of a streamed printout. In streaming mode, the top-level sub-brackets
+ * of the root are printed and discarded as soon as the next top-level key appears,
+ * relying on FORM sorting its output so that each key occurs in one contiguous
+ * run. If a key turns up again after it has been printed, streaming is turned
+ * off and the rest of the expression is buffered as usual.
+ * 
+ * The first two members are used when parsing, to decide when a part of the tree
+ * is complete, and the rest when printing it. (These may happen in different
+ * threads, each with their own stream_state.)
+ */
+struct stream_state {
+    bool enabled = true;            //false after falling back to buffering
+    flat_insertion_order_map< symbol_key, bool, symbol_key::hasher > done;  //keys that have been completed
+    arena done_ids;                 //IDs of the keys in done
+    
+    bool started = false;           //true once something has been printed
+    bool printed_sub = false;       //true once a sub-bracket has been printed
+    bool prev_single_line = false;  //whether the last printed sub-bracket was single-line
+    
+    void reset(){
+        enabled = true;
+        done.clear();
+        done_ids.release();
+        started = false;
+        printed_sub = false;
+        prev_single_line = false;
+    }
+};
+        
+/*
+ * Spilling of bracket content to disk, for --mem-limit. The content lines of the
+ * trees are then kept in an arena of their own, and when a tree takes up more than
+ * the limit, the content of its brackets is appended to a spill_file, which leaves
+ * only the offsets in the brackets, and the arena is released. Spilled lines are
+ * read back from the file when the tree is printed.
+ * 
+ * Spilled content is discarded when the next tree is created (see new_tree()), so
+ * each tree must have been printed by then, which is the case unless it is handed
+ * to another thread.
+ */
+struct bracket;
+
+struct content_spill {
+    size_t limit;
+    arena lines;
+    spill_file file;
+    std::vector<bracket*> dirty;    //brackets with content in lines, in order of creation
+    bool warned = false;            //whether the limit was found to be too small
+    
+    explicit content_spill(size_t l) : limit(l), lines(), file(), dirty() {};
+    
+    void reset(){
+        lines.release();
+        file.clear();
+        dirty.clear();
+    }
+};
+
+//Content lines of a bracket that have been spilled at once
+struct spill_extent {
+    uint64_t offset;
+    uint64_t bytes;
+    size_t lines;
+};
+
+/*
+ * Hash-consing of bracket bodies, for --share. While a tree is parsed, each distinct
+ * content line is stored once, so identical bodies are made of the same views, and
+ * each copy after the first costs only those. When the tree is complete, the bodies
+ * of the leaves that occur more than once are replaced by a reference to a named
+ * abbreviation such as [_MB_S1], which is defined after the expression (see
+ * bracket::share_bodies()).
+ */
+struct body_sharing {
+    static constexpr size_t min_length = 64;    //shorter bodies are cheaper to repeat
+    
+    //A body, identified by its interned lines
+    struct body {
+        const std::string_view* lines;
+        size_t n;
+        
+        bool operator== (const body& b) const {
+            if(n != b.n)
+                return false;
+            for(size_t i = 0; i < n; i++){
+                if(lines[i].data() != b.lines[i].data() || lines[i].length() != b.lines[i].length())
+                    return false;
+            }
+            return true;
+        }
+    };
+    struct body_hasher {
+        size_t operator()(const body& b) const {
+            size_t h = b.n;
+            for(size_t i = 0; i < b.n; i++)
+                h = h * 31 + std::hash<const void*>()(b.lines[i].data());
+            return h;
+        }
+    };
+    struct body_info {
+        size_t count;
+        size_t name;                    //number of the abbreviation, 0 if none yet
+    };
+    
+    flat_insertion_order_map< std::string_view, bool > lines;          //of the current tree
+    flat_insertion_order_map< body, body_info, body_hasher > bodies;    //of the current tree
+    size_t n_names = 0;
+    
+    //Returns the stored copy of line, copying it into mem if it is new
+    std::string_view intern(std::string_view line, arena& mem){
+        auto it = lines.find(line);
+        if(it != lines.end())
+            return it->first;
+        
+        std::string_view copy = mem.copy(line);
+        lines.insert(std::make_pair(copy, true));
+        return copy;
+    }
+    
+    void reset(){
+        lines.clear();
+        bodies.clear();
+    }
+};
+
+/*
+ * A bracket and its sub-brackets. The whole tree, including keys and content,
+ * lives in an arena: brackets are never destroyed individually, but the entire
+ * tree is discarded at once by releasing the arena (see create()). With a
+ * content_spill, content lines live in its arena instead, or in its file.
+ */
+struct bracket {
+    using br_ptr = bracket*;
+    
+private:
+    std::string_view key;           //text of the key, for printing
+    content_list content;           //lines that have not been spilled
+    size_t terms;                   //number of terms whose content is in this bracket
+    
+    flat_insertion_order_map< symbol_key, br_ptr, symbol_key::hasher,
+                              arena_allocator< std::pair<symbol_key, br_ptr> > > sub_brackets;
+    
+    //Lines spilled so far, which come before those in content
+    std::vector< spill_extent, arena_allocator<spill_extent> > spilled;
+    
+    arena& mem;
+    content_spill* spill;
+    
+public:
+    bracket( std::string_view k, arena& m, content_spill* sp = nullptr )
+    : key(k), content(sp ? sp->lines : m), terms(0), sub_brackets(m), spilled(m), mem(m), spill(sp) {};
+    
+    //Creates an empty root bracket in the arena. It is valid until the arena is released,
+    //and with a content_spill, until that is reset.
+    static bracket* create(arena& mem, content_spill* spill = nullptr){
+        return mem.create<bracket>(std::string_view(), mem, spill);
+    }
+    
+    //Finds or creates the sub-bracket with the given keys, and reads the rest of the term
+    //(the part inside the bracket, up to the closing parenthesis) into it. With a
+    //body_sharing, identical lines are stored once.
+    void parse_body(const key_parser& keys, const std::vector<symbol_key>& br_keys,
+                    term_lexer& lexer, body_sharing* sharing = nullptr)
+    {
+        bracket *br = this;
+        size_t n_level = br_keys.size() - 1;
+        for(size_t lvl = 0; lvl <= n_level; lvl++){
+            if(br_keys[lvl].empty())
+                continue;
+                        
+            auto sub = br->sub_brackets.find( br_keys[lvl] );
+            
+            if(sub == br->sub_brackets.end()){
+                bracket* new_br = mem.create<bracket>(keys.text(br_keys[lvl], mem), mem, spill);
+                br = (br->sub_brackets[ br_keys[lvl].copy(mem) ] = new_br);
+            }
+            else
+                br = sub->second;
+        }
+        
+        br->terms++;
+        arena& line_mem = spill ? spill->lines : mem;
+        if(spill && br->content.empty())
+            spill->dirty.push_back(br);
+        while(lexer.next() == term_lexer::token::body_line){
+            br->content.push_back( sharing ? sharing->intern(lexer.value(), line_mem)
+                                           : line_mem.copy(lexer.value()) );
+        }
+    }
+    
+    //Replaces the bodies of the leaves of a complete tree that occur more than once
+    //by a reference to an abbreviation, calling define(name, lines) for each new one
+    //(the lines stay valid with the tree). The root's own content is kept as it is.
+    template< typename F >
+    void share_bodies(body_sharing& sharing, F define){
+        for(auto& [k, ptr] : sub_brackets)
+            ptr->count_bodies(sharing);
+        for(auto& [k, ptr] : sub_brackets)
+            ptr->abbreviate(sharing, define);
+    }
+    
+    //Spills the content of the tree if it takes up more than the limit of its
+    //content_spill (if any). Called on the root after each term.
+    void limit_memory(){
+        if(!spill || mem.used() + spill->lines.used() <= spill->limit)
+            return;
+        
+        //Spilling little content would only make every term spill again
+        if(spill->lines.used() < spill->limit / 4){
+            if(!spill->warned)
+                std::cerr << "WARNING: the brackets alone take up most of --mem-limit" << std::endl;
+            spill->warned = true;
+            return;
+        }
+        for(bracket* br : spill->dirty)
+            br->spill_content();
+        spill->dirty.clear();
+        spill->lines.release();
+    }
+    
+    //Return value is true if printout was single-line
+    // (line breaks due to overlong lines don't count). If index is given, the
+    //bracket is added to it (for the root, only its terms).
+    bool print(indent_stream& out, bool root = false, output_index_writer* index = nullptr) const {
+        if(!index)
+            return print_node(out, root, index);
+        
+        if(root){
+            index->add_terms(terms);
+            return print_node(out, root, index);
+        }
+        index->begin(key);
+        index->add_terms(terms);
+        bool single_line = print_node(out, root, index);
+        index->end();
+        return single_line;
+    }
+    
+    //The layout of print()
+    bool print_node(indent_stream& out, bool root, output_index_writer* index) const {
+        out << key;
+        bool single_line;
+        
+        if(sub_brackets.empty()){
+            if(!root)
+                out << " * ( ";
+            
+            size_t n_lines = lines();
+            if(n_lines > 1){
+                out.incr_indent().paragraph();
+                
+                for_each_line([&](std::string_view line){
+                    out.incr_indent() << line;
+                    out.decr_indent().paragraph();
+                });
+                
+                if(!root)
+                    out << ")";
+                out.decr_indent();
+                
+                return false;
+            }
+            else if(n_lines == 0){
+                //Only the root can be empty, if no terms were selected
+                out << " 0";
+                return true;
+            }
+            else{
+                for_each_line([&](std::string_view line){
+                    out.incr_indent(2) << line;
+                });
+                if(!root)
+                    out << " )";
+                out.decr_indent(2);
+                
+                return true;
+            }
+        }
+        else{
+            if(!root && lines() == 0 && sub_brackets.size() == 1){
+                out << "*";
+//                 out.incr_indent();
+                
+                single_line = sub_brackets.cbegin()->second->print(out, false, index);
+                
+//                 out.decr_indent();
+                return single_line;
+            }
+            else{
+                if(!root){
+                    out << " * ( ";
+                    out.incr_indent();
+                }
+                
+                if(lines() > 0)
+                    print_content(out);
+                
+                for(auto it = sub_brackets.begin(); it != sub_brackets.end(); ){
+                    out.paragraph() << "+ ";
+                    single_line = it->second->print(out, false, index);
+                    
+                    ++it;
+                    
+                    //This is a bit confusing. What it does is:
+                    //   sub-brackets are normally separated by an empty line
+                    //   ...but not single-line ones (NOTE: this makes expressions more compact)
+                    //   ...and not the last one (that is handled later)
+                    //   ...however, if a single-line is followed by a mutliple-line, insert blank line.
+                    if(it != sub_brackets.end() && (!single_line || !it->second->is_single_line())){             
+                        out.paragraph();
+                    }
+                }
+                if(!root){
+                    out.paragraph() << ")";
+                    out.decr_indent();
+                }
+                
+                return false;
+            }
+        }
+    }
+    
+    //Checks whether a term with the given keys is about to open a new top-level
+    //sub-bracket. If so, returns true, and the tree so far is complete and should
+    //be printed with stream_print() and then discarded.
+    bool stream_completed(const key_parser& keys, const std::vector<symbol_key>& br_keys,
+                          stream_state& stream)
+    {
+        if(!stream.enabled)
+            return false;
+        
+        const symbol_key& key = br_keys[top_level(br_keys)];
+        
+        if(stream.done.count(key) || (key.empty() && !stream.done.empty())){
+            std::cerr << "WARNING: bracket \"" << keys.text(key) << "\" out of order, "
+                      << "falling back to full buffering" << std::endl;
+            stream.enabled = false;
+            return false;
+        }
+        
+        if(key.empty() || sub_brackets.empty() || sub_brackets.rbegin()->first == key)
+            return false;
+        
+        for(auto& [k, ptr] : sub_brackets)
+            stream.done.emplace(k.copy(stream.done_ids), true);
+        return true;
+    }
+    
+    //Prints a tree found to be complete by stream_completed(), continuing the layout
+    //of print(out, true) from where the previous call left off
+    void stream_print(indent_stream& out, stream_state& stream,
+                      output_index_writer* index = nullptr) const {
+        if(index)
+            index->add_terms(terms);
+        if(!stream.started){
+            if(lines() > 0)
+                print_content(out);
+            stream.started = true;
+        }
+        stream_sub_brackets(out, stream, index);
+    }
+    
+    //Prints what remains of a streamed expression, without the final semicolon
+    void stream_finish(indent_stream& out, stream_state& stream,
+                       output_index_writer* index = nullptr) const {
+        if(!stream.started){
+            print(out, true, index);
+            return;
+        }
+        if(index)
+            index->add_terms(terms);
+        
+        if(lines() > 0){
+            std::cerr << "WARNING: bracket content out of order, "
+                      << "printing it after the sub-brackets" << std::endl;
+            print_content(out);
+            stream.prev_single_line = false;
+        }
+        stream_sub_brackets(out, stream, index);
+    }
+    
+    //Adds the number of sub-brackets on each level below this one, the largest
+    //content and (for the root) the bytes allocated for the tree to the statistics.
+    //Arenas only grow until they are released, so for a complete tree these are
+    //the most it has had in memory (apart from content spilled before).
+    void count(stats_counts& c, size_t level = 0) const {
+        c.max_content = std::max<uint64_t>(c.max_content, lines());
+        if(level == 0)
+            c.peak_arena = std::max<uint64_t>(c.peak_arena, mem.used() + (spill ? spill->lines.used() : 0));
+        if(sub_brackets.empty())
+            return;
+        
+        if(c.nodes.size() <= level)
+            c.nodes.resize(level + 1);
+        c.nodes[level] += sub_brackets.size();
+        for(auto& [k, ptr] : sub_brackets)
+            ptr->count(c, level + 1);
+    }
+    
+    //Writes the tree to a json_tree_writer or bin_tree_writer, in the order of print()
+    template< typename Writer >
+    void write(Writer& w) const {
+        w.begin_node(key, lines(), sub_brackets.size());
+        for_each_line([&](std::string_view line){
+            w.content(line);
+        });
+        w.end_content();
+        
+        for(auto& [k, ptr] : sub_brackets)
+            ptr->write(w);
+        w.end_node();
+    }
+    
+    //Basically a "dry run" of print(out, true)
+    bool is_single_line() const {
+        bool single_line;
+        
+        if(sub_brackets.empty()){
+            return (lines() <= 1);
+        }
+        else{
+            if(lines() == 0 && sub_brackets.size() == 1){
+                return sub_brackets.cbegin()->second->is_single_line();
+            }
+            else{
+                return false;
+            }
+        }
+    }
+    
+private:
+    void count_bodies(body_sharing& sharing) const {
+        if(!sub_brackets.empty()){
+            for(auto& [k, ptr] : sub_brackets)
+                ptr->count_bodies(sharing);
+            return;
+        }
+        
+        size_t length = 0;
+        for(std::string_view line : content)
+            length += line.length();
+        if(length >= body_sharing::min_length)
+            sharing.bodies[body_sharing::body{content.data(), content.size()}].count++;
+    }
+    
+    //The keys of sharing.bodies keep pointing to the replaced content, which stays
+    //in the arena like everything else in the tree
+    template< typename F >
+    void abbreviate(body_sharing& sharing, F& define){
+        if(!sub_brackets.empty()){
+            for(auto& [k, ptr] : sub_brackets)
+                ptr->abbreviate(sharing, define);
+            return;
+        }
+        
+        auto it = sharing.bodies.find(body_sharing::body{content.data(), content.size()});
+        if(it == sharing.bodies.end() || it->second.count < 2)
+            return;
+        
+        if(it->second.name == 0){
+            it->second.name = ++sharing.n_names;
+            define(it->second.name, content);
+        }
+        std::string ref = "+ [_MB_S" + std::to_string(it->second.name) + "]";
+        content_list(1, mem.copy(ref), content.get_allocator()).swap(content);
+    }
+    
+    //Number of content lines, spilled or not
+    size_t lines() const {
+        size_t n = content.size();
+        for(const spill_extent& e : spilled)
+            n += e.lines;
+        return n;
+    }
+    
+    //Passes the content lines to f in order, reading back those that were spilled
+    template< typename F >
+    void for_each_line(F f) const {
+        for(const spill_extent& e : spilled)
+            spill->file.read_lines(e.offset, e.bytes, f);
+        for(std::string_view line : content)
+            f(line);
+    }
+    
+    //Appends the content lines that are in memory to the spill file, leaving the
+    //content list empty (and no longer using the content arena)
+    void spill_content(){
+        if(content.empty())
+            return;
+        
+        uint64_t offset = spill->file.size();
+        for(std::string_view line : content)
+            spill->file.append_line(line);
+        spilled.push_back(spill_extent{offset, spill->file.size() - offset, content.size()});
+        content_list(content.get_allocator()).swap(content);
+    }
+    
+    void print_content(indent_stream& out) const {
+        out.paragraph();
+        
+        bool single = (lines() == 1);
+        for_each_line([&](std::string_view line){
+            if(single && !is_plusminus(line[0]))
+                out << "+ ";
+            out.incr_indent() << line;
+            out.decr_indent().paragraph();
+        });
+    }
+    
+    //Prints all sub-brackets as part of a streamed printout
+    void stream_sub_brackets(indent_stream& out, stream_state& stream,
+                             output_index_writer* index) const {
+        for(auto& [k, ptr] : sub_brackets){
+            //Same blank line rule as in print(), but decided before rather than after
+            if(stream.printed_sub && (!stream.prev_single_line || !ptr->is_single_line()))
+                out.paragraph();
+            
+            out.paragraph() << "+ ";
+            stream.prev_single_line = ptr->print(out, false, index);
+            stream.printed_sub = true;
+        }
+    }
+};
+
+//A piece of one end of a ... range: either literal text or a number that may vary
+struct range_piece {
+    std::string text;
+    bool number;
+    long long value;
+    size_t width;   //nonzero if zero-padded
+};
+
+//Splits an end of a ... range into pieces, returning false if it is malformed
+bool split_range_end(std::string_view s, std::vector<range_piece>& pieces){
+    bool angled = (s.find('<') != std::string_view::npos);
+    bool inside = !angled;
+    std::string text;
+    
+    for(size_t i = 0; i < s.length(); ){
+        if(angled && (s[i] == '<' || s[i] == '>')){
+            //Angle brackets must alternate and not nest
+            if(inside == (s[i] == '<'))
+                return false;
+            inside = !inside;
+            i++;
+        }
+        else if(inside && std::isdigit(s[i])){
+            size_t j = i;
+            while(j < s.length() && std::isdigit(s[j]))
+                j++;
+            if(j - i > 18)
+                return false;
+            
+            pieces.push_back({text, false, 0, 0});
+            text.clear();
+            pieces.push_back({"", true, std::stoll(std::string(s.substr(i, j - i))),
+                              (s[i] == '0' && j - i > 1) ? j - i : 0});
+            i = j;
+        }
+        else
+            text += s[i++];
+    }
+    pieces.push_back({text, false, 0, 0});
+    
+    return !(angled && inside);
+}
+
+/*
+ * Expands FORM's ... operator for the range first,...,last without invoking FORM.
+ * If either end contains angle brackets, only the numbers between them vary
+ * (and the brackets are dropped); otherwise all numbers in the ends may vary.
+ * The ends must be identical apart from the varying numbers, and those numbers
+ * that differ between the ends must span ranges of the same length, which are
+ * stepped through in unison (upwards or downwards). Leading zeros are kept. E.g.
+ *   a1,...,a4         ->  a1,a2,a3,a4
+ *   <f1x>,...,<f3x>   ->  f1x,f2x,f3x
+ *   <p1q3>,...,<p3q1> ->  p1q3,p2q2,p3q1
+ * 
+ * Returns false if the ends do not fit this pattern, in which case nothing is
+ * added to expansion.
+ */
+bool expand_range(std::string_view first, std::string_view last, std::vector<std::string>& expansion){
+    std::vector<range_piece> from, to;
+    if(!split_range_end(first, from) || !split_range_end(last, to) || from.size() != to.size())
+        return false;
+    
+    //All varying numbers must take the same number of steps
+    long long steps = 0;
+    for(size_t i = 0; i < from.size(); i++){
+        if(from[i].number != to[i].number)
+            return false;
+        if(!from[i].number){
+            if(from[i].text != to[i].text)
+                return false;
+            continue;
+        }
+        
+        long long diff = std::llabs(to[i].value - from[i].value);
+        if(diff == 0)
+            continue;
+        if(steps != 0 && diff != steps)
+            return false;
+        steps = diff;
+    }
+    
+    for(long long step = 0; step <= steps; step++){
+        std::string elem;
+        for(size_t i = 0; i < from.size(); i++){
+            if(!from[i].number){
+                elem += from[i].text;
+                continue;
+            }
+            
+            long long value = from[i].value + (to[i].value > from[i].value ? step 
+                                             : to[i].value < from[i].value ? -step : 0);
+            std::string digits = std::to_string(value);
+            if(digits.length() < from[i].width)
+                digits.insert(0, from[i].width - digits.length(), '0');
+            elem += digits;
+        }
+        expansion.push_back(elem);
+    }
+    return true;
+}
+
+void parse_bracket_symbols(size_t level, const std::string& symbol_group, 
+                           flat_insertion_order_map< std::string, size_t >& br_symbols,
+                           bool form_ranges);
+
+//Expands first,...,last by running FORM's preprocessor on a temporary file, and
+//parses the result into br_symbols
+void form_expand_range(size_t level, std::string_view first, std::string_view last,
+                       flat_insertion_order_map< std::string, size_t >& br_symbols)
+{
+    //Create temporary file:
+    /*
+     *   * Temporary file for use by multibracket
+     *   #-
+     *   [_MB_],<first>,...,<last>;
+     *   .end
+     */
+    //The multibracket tag is used to find the line containing the results.
+    //The file names include the process ID, so that concurrent runs don't collide.
+    std::string tmp_name = ".multibracket_tmp." + std::to_string(getpid());
+    std::ofstream tmp(tmp_name + ".frm");
+    tmp << "* Temporary file for use by multibracket\n#-\n" MULTIBRACKET_TAG ",";
+    tmp << first << ",...,";
+    tmp << last << ";\n#+\n#+\n.end\n";
+    tmp.close();
+    
+    int status = system(("form -y " + tmp_name + ".frm > " + tmp_name + ".log").c_str());
+    
+    //Find output line, parse it, and ignore the rest
+    //NOTE: FORM doesn't support it (yet), but this is compatible
+    //with nested use of the ... operator!
+    size_t pos;
+    bool valid = false;
+    if(status == 0){
+        line_reader processed_tmp(tmp_name + ".log");
+        for(std::string_view line; processed_tmp.getline(line); ){
+            if((pos = line.find(MULTIBRACKET_TAG)) != std::string::npos){
+                pos += std::strlen(MULTIBRACKET_TAG) + 1;
+                
+                parse_bracket_symbols(
+                    level, 
+                    //This is a bit hacky, but does the job nicely when the expansion is long
+                    read_broken_line(line, pos, '#', processed_tmp),
+                    br_symbols, true
+                );
+                
+                valid = true;
+                break;
+            }
+        }
+    }
+    
+    std::remove((tmp_name + ".frm").c_str());
+    std::remove((tmp_name + ".log").c_str());
+    
+    //No output means something went awry
+    if(!valid)
+        throw std::runtime_error("ERROR: improper use of ... operator");
+}
+
+/*
+ * Parses one argument of multibracket into br_symbols at the given level.
+ * FORM's ... operator is expanded natively if possible (see expand_range),
+ * and otherwise by invoking FORM if form_ranges is set.
+ */
+void parse_bracket_symbols(size_t level, const std::string& symbol_group, 
+                           flat_insertion_order_map< std::string, size_t >& br_symbols,
+                           bool form_ranges)
+{
+
+    size_t pos = 0;
+    auto split_group = split(symbol_group, pos, ", ", "[]");
+    for(auto it = split_group.begin(); it != split_group.end(); it++){
+        
+        //Handle FORM's ... operator. The beginning of the range has already
+        //been inserted as it is, so it is replaced by the expansion.
+        if(*it == "..."){
+            if(it == split_group.begin())
+                throw std::runtime_error("ERROR: empty beginning of ... range");
+            std::string_view first = *(it - 1);
+            ++it;
+            if(it == split_group.end())
+                throw std::runtime_error("ERROR: empty end of ... range");
+            std::string_view last = *it;
+            
+            auto unexpanded = br_symbols.find(first);
+            if(unexpanded != br_symbols.end() && unexpanded->second == level)
+                br_symbols.erase(unexpanded);
+            
+            std::vector<std::string> expansion;
+            if(expand_range(first, last, expansion)){
+                for(std::string& sym : expansion)
+                    br_symbols.insert(std::make_pair(std::move(sym), level));
+            }
+            else if(form_ranges)
+                form_expand_range(level, first, last, br_symbols);
+            else
+                throw std::runtime_error("ERROR: can not expand " + std::string(first) + ",...," 
+                                         + std::string(last) + " (try --form-ranges)");
+        }
+        //No ... operator, just insert symbol
+        else            
+            br_symbols.insert(std::make_pair(std::string(*it), level));
+    }
+}
+
+/*
+ * What a tree handed from the parser to the printer represents: the completed
+ * part of an expression in streaming mode, the (rest of the) expression up to its
+ * terminating semicolon, or whatever was read of an expression before an error.
+ */
+enum class tree_kind { stream_part, expression, unfinished };
+
+/*
+ * Receives the results of parse_input(), in the order in which they should be
+ * printed: lines to pass through unchanged (one or more at a time, separated by
+ * newlines), and trees built in arenas obtained from the sink itself. Each call to
+ * new_arena() hands over the previous one (whose contents are no longer used by
+ * the parser).
+ */
+struct parse_sink {
+    virtual ~parse_sink() = default;
+    
+    virtual void text(std::string_view lines) = 0;
+    virtual arena& new_arena() = 0;
+    virtual void tree(const bracket* root, tree_kind kind) = 0;
+};
+
+//Creates an empty tree in a new arena from sink, discarding the content spilled for
+//the previous one (if spilling) and the lines interned for it (if sharing)
+bracket* new_tree(parse_sink& sink, content_spill* spill, body_sharing* sharing = nullptr){
+    arena& mem = sink.new_arena();
+    if(spill)
+        spill->reset();
+    if(sharing)
+        sharing->reset();
+    return bracket::create(mem, spill);
+}
+
+/*
+ * Shares the repeated bodies of a complete tree (see body_sharing), and returns the
+ * lines of text that define the abbreviations, to be printed after it: a declaration
+ * of them as symbols, and an id statement for each, so that FORM can read them back.
+ */
+std::vector<std::string> share_bodies(bracket* root, body_sharing& sharing){
+    std::vector<std::string> lines;
+    size_t first = sharing.n_names + 1;
+    
+    root->share_bodies(sharing, [&](size_t name, const content_list& body){
+        lines.push_back("");
+        lines.push_back("   id [_MB_S" + std::to_string(name) + "] =");
+        for(std::string_view line : body)
+            lines.push_back("      " + std::string(line));
+        lines.back() += ";";
+    });
+    if(lines.empty())
+        return lines;
+    
+    std::vector<std::string> decl(1, "");
+    std::string s = "   S";
+    for(size_t name = first; name <= sharing.n_names; name++){
+        std::string ref = "[_MB_S" + std::to_string(name) + "]";
+        if(s.length() + ref.length() + 2 > 79){
+            decl.push_back(s);
+            s = "    ";
+        }
+        s += (name == first) ? " " : ",";
+        s += ref;
+    }
+    decl.push_back(s + ";");
+    
+    lines.insert(lines.begin(), decl.begin(), decl.end());
+    return lines;
+}
+
+/*
+ * Reads FORM output and passes it to sink: untagged lines as they are, and each
+ * tagged expression as a tree (or, in streaming mode, as a sequence of trees).
+ * With a selection, terms that it does not select are skipped. If mem_limit is
+ * nonzero, the content of a tree that grows larger than that is spilled to disk
+ * (see content_spill), in which case sink must print each tree before returning.
+ * If share is set, repeated bodies are shared (see body_sharing), and the
+ * definitions of their abbreviations follow each expression as text.
+ */
+void parse_input(line_reader& in, const symbol_classifier& classifier, bool streaming,
+                 parse_sink& sink, const bracket_selection* select = nullptr, size_t mem_limit = 0,
+                 bool share = false, run_stats* stats = nullptr)
+{
+    key_parser keys(classifier);
+    std::unique_ptr<key_selector> selector(select ? new key_selector(*select) : nullptr);
+    std::unique_ptr<content_spill> spill(mem_limit ? new content_spill(mem_limit) : nullptr);
+    std::unique_ptr<body_sharing> sharing(share ? new body_sharing() : nullptr);
+    stream_state stream;
+    bracket* root = new_tree(sink, spill.get(), sharing.get());
+    
+    //Adds a tree that is about to be handed over, and the input so far, to the statistics
+    auto count = [&](const bracket* tree){
+        if(stats){
+            tree->count(stats->expression);
+            stats->input(in.bytes_read(), in.lines_read(), in.read_seconds());
+        }
+    };
+    
+    bool multibracket = false;
+    term_lexer lexer(in, MULTIBRACKET);
+    for(term_lexer::token t; (t = lexer.next()) != term_lexer::token::end_of_input; ){
+        
+        if(t == term_lexer::token::text){
+            if(stats)
+                stats->text(lexer.value());
+            sink.text(lexer.value());
+        }
+        else if(t == term_lexer::token::term_start){
+            if(stats){
+                if(!multibracket)
+                    stats->begin_expression();
+                stats->expression.terms++;
+            }
+            multibracket = true;
+            
+            const std::vector<symbol_key>* br_keys;
+            {
+                stats_timer timer(stats ? &stats->expression.parse : nullptr);
+                stats_timer split_timer(stats ? &stats->expression.split : nullptr);
+                br_keys = &keys.parse(lexer);
+            }
+            if(selector && !selector->selected(keys, *br_keys)){
+                lexer.skip_body();
+                continue;
+            }
+            if(streaming && root->stream_completed(keys, *br_keys, stream)){
+                count(root);
+                sink.tree(root, tree_kind::stream_part);
+                root = new_tree(sink, spill.get(), sharing.get());
+            }
+            {
+                stats_timer timer(stats ? &stats->expression.parse : nullptr);
+                root->parse_body(keys, *br_keys, lexer, sharing.get());
+                root->limit_memory();
+            }
+        }
+        else if(t == term_lexer::token::expression_end){
+            count(root);
+            std::vector<std::string> definitions;
+            if(sharing)
+                definitions = share_bodies(root, *sharing);
+            sink.tree(root, tree_kind::expression);
+            for(const std::string& line : definitions)
+                sink.text(line);
+            root = new_tree(sink, spill.get(), sharing.get());
+            stream.reset();
+            multibracket = false;
+            
+            //No keys are held between expressions
+            bool forgotten = keys.trim();
+            if(selector)
+                selector->trim(forgotten);
+        }
+    }
+    
+    if(multibracket){
+        count(root);
+        sink.tree(root, tree_kind::unfinished);
+        throw std::runtime_error("ERROR: unexpected EOF");
+    }
+    if(stats)
+        stats->input(in.bytes_read(), in.lines_read(), in.read_seconds());
+}
+
+/*
+ * Merge mode: the output of several FORM runs that each computed part of the same
+ * expressions (such as sharded jobs) is combined into one multibracketed result.
+ * The i-th tagged expression of every input is merged into one tree, so that
+ * brackets with the same key on every level are joined and their content is
+ * appended in the order of the inputs. The text outside expressions is taken from
+ * the first input; that of the others is only used to check that the expressions
+ * have the same names.
+ */
+struct merge_input {
+    std::string path;
+    int fd;
+    std::unique_ptr<decompressing_reader> input;
+    std::unique_ptr<line_reader> in;
+    std::unique_ptr<term_lexer> lexer;
+    std::string name;               //name of the next expression, if announced
+    
+    bool at_term;                   //whether the lexer has just returned term_start
+    std::vector<symbol_id> ids;     //IDs of the keys of the pending term
+    std::vector<symbol_key> keys;   //keys of the pending term, pointing into ids
+    size_t top;                     //level of the top-level key of the pending term
+    run_stats* stats;               //null unless collecting statistics
+    
+    explicit merge_input(const std::string& p, run_stats* s = nullptr)
+    : path(p), fd(::open(p.c_str(), O_RDONLY)), input(), in(), lexer(), name(),
+      at_term(false), ids(), keys(), top(0), stats(s)
+    {
+        if(fd < 0)
+            throw std::runtime_error("ERROR: could not open " + path);
+        try{
+            input.reset(new decompressing_reader(fd));
+            in.reset(input->passthrough()
+                ? new line_reader(fd)
+                : new line_reader([this](char* buf, size_t n){ return input->read(buf, n); }));
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        lexer.reset(new term_lexer(*in, MULTIBRACKET));
+    }
+    
+    merge_input(const merge_input&) = delete;
+    merge_input& operator= (const merge_input&) = delete;
+    
+    ~merge_input(){
+        lexer.reset();
+        in.reset();
+        input.reset();
+        ::close(fd);
+    }
+    
+    //Moves on to the first term of the next expression, passing the text before it
+    //to sink (if any). Returns false if there is none.
+    bool next_expression(parse_sink* sink){
+        name.clear();
+        for(term_lexer::token t; (t = lexer->next()) != term_lexer::token::end_of_input; ){
+            if(t == term_lexer::token::term_start){
+                at_term = true;
+                return true;
+            }
+            if(sink)
+                sink->text(lexer->value());
+            if(stats && sink)
+                stats->text(lexer->value());
+            std::string_view line = term_lexer::last_line(lexer->value());
+            if(!line.empty())
+                name = term_lexer::expression_name(line);
+        }
+        return false;
+    }
+    
+    //Reads the keys of the next selected term of the current expression into keys,
+    //leaving the lexer before its body. Returns false at the end of the expression.
+    bool next_term(key_parser& parser, key_selector* selector){
+        for(;;){
+            term_lexer::token t = at_term ? term_lexer::token::term_start : lexer->next();
+            at_term = false;
+            if(t == term_lexer::token::expression_end)
+                return false;
+            if(t != term_lexer::token::term_start)
+                throw std::runtime_error("ERROR: unexpected EOF in " + path);
+            
+            if(stats)
+                stats->expression.terms++;
+            const std::vector<symbol_key>* br_keys;
+            {
+                stats_timer timer(stats ? &stats->expression.parse : nullptr);
+                stats_timer split_timer(stats ? &stats->expression.split : nullptr);
+                br_keys = &parser.parse(*lexer);
+            }
+            if(selector && !selector->selected(parser, *br_keys)){
+                lexer->skip_body();
+                continue;
+            }
+            
+            //The keys returned by the parser are overwritten by the next term, which may
+            //be read from another input before this one's body
+            ids.clear();
+            for(const symbol_key& k : *br_keys)
+                ids.insert(ids.end(), k.ids, k.ids + k.n);
+            keys = *br_keys;
+            size_t offset = 0;
+            for(symbol_key& k : keys){
+                k.ids = ids.data() + offset;
+                offset += k.n;
+            }
+            top = top_level(keys);
+            return true;
+        }
+    }
+    
+    //Reads the body of the pending term into the tree
+    void parse_body(bracket* root, const key_parser& parser){
+        stats_timer timer(stats ? &stats->expression.parse : nullptr);
+        root->parse_body(parser, keys, *lexer);
+        root->limit_memory();
+    }
+};
+
+//Compares two factors by their text, except that numbers in them are compared by
+//value, so that e.g. a9 comes before a10 (as in a range a1,...,a10)
+int compare_factors(std::string_view a, std::string_view b){
+    size_t i = 0, j = 0;
+    while(i < a.length() && j < b.length()){
+        if(std::isdigit(uint8_t(a[i])) && std::isdigit(uint8_t(b[j]))){
+            while(i < a.length() && a[i] == '0')
+                i++;
+            while(j < b.length() && b[j] == '0')
+                j++;
+            size_t ni = i, nj = j;
+            while(ni < a.length() && std::isdigit(uint8_t(a[ni])))
+                ni++;
+            while(nj < b.length() && std::isdigit(uint8_t(b[nj])))
+                nj++;
+            
+            if(ni - i != nj - j)
+                return ni - i < nj - j ? -1 : 1;
+            int c = a.substr(i, ni - i).compare(b.substr(j, nj - j));
+            if(c != 0)
+                return c;
+            i = ni;
+            j = nj;
+        }
+        else if(a[i] != b[j])
+            return uint8_t(a[i]) < uint8_t(b[j]) ? -1 : 1;
+        else{
+            i++;
+            j++;
+        }
+    }
+    return (i < a.length()) - (j < b.length());
+}
+
+/*
+ * Orders the keys of terms for the sorted merge, level by level, with the empty key
+ * first, so that the terms with the same key on the top level (the first that is
+ * not empty) are contiguous, and the content of the root comes first. Keys on the
+ * same level are ordered factor by factor (see compare_factors), with a key that
+ * is a prefix of another first. Returns a negative number, zero or a positive
+ * number as a is before, equal to or after b.
+ */
+int compare_keys(const key_parser& parser, const std::vector<symbol_key>& a,
+                 const std::vector<symbol_key>& b)
+{
+    for(size_t lvl = 0; lvl < a.size(); lvl++){
+        const symbol_key& ka = a[lvl];
+        const symbol_key& kb = b[lvl];
+        if(ka == kb)
+            continue;
+        
+        for(uint32_t i = 0; i < ka.n && i < kb.n; i++){
+            if(ka.ids[i] == kb.ids[i])
+                continue;
+            int c = compare_factors(parser.factor(ka.ids[i]), parser.factor(kb.ids[i]));
+            if(c != 0)
+                return c;
+        }
+        if(ka.n != kb.n)
+            return ka.n < kb.n ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Merges one expression from all inputs, each positioned at its first term, by
+ * inserting every term into the same tree, whose keys are hashed on every level.
+ */
+void merge_hashed(std::vector< std::unique_ptr<merge_input> >& inputs, key_parser& parser,
+                  key_selector* selector, bracket* root)
+{
+    for(auto& mi : inputs){
+        while(mi->next_term(parser, selector))
+            mi->parse_body(root, parser);
+    }
+}
+
+/*
+ * Merges one expression from all inputs, each positioned at its first term, as a
+ * k-way merge of their terms by key (see compare_keys). The input whose pending
+ * term has the least keys is read from next (the first such input in case of
+ * ties), so that if the terms of each input are sorted, the terms are added to the
+ * tree in order, and each top-level bracket is complete as soon as a term with a
+ * different top-level key is read. It is then passed to sink as a part of the
+ * expression. If an input turns out not to be sorted, the rest of the expression
+ * is merged into one tree as by merge_hashed(). Returns the tree holding the rest
+ * of the expression.
+ */
+bracket* merge_sorted(std::vector< std::unique_ptr<merge_input> >& inputs, key_parser& parser,
+                      key_selector* selector, bracket* root, parse_sink& sink, content_spill* spill,
+                      run_stats* stats)
+{
+    auto after = [&](size_t i, size_t j){
+        int c = compare_keys(parser, inputs[i]->keys, inputs[j]->keys);
+        return c > 0 || (c == 0 && i > j);
+    };
+    std::priority_queue< size_t, std::vector<size_t>, decltype(after) > heap(after);
+    for(size_t i = 0; i < inputs.size(); i++){
+        if(inputs[i]->next_term(parser, selector))
+            heap.push(i);
+    }
+    
+    //The keys of the last term added to the tree
+    std::vector<symbol_id> last_ids;
+    std::vector<symbol_key> last;
+    size_t last_top = 0;
+    
+    while(!heap.empty()){
+        size_t i = heap.top();
+        heap.pop();
+        merge_input& mi = *inputs[i];
+        
+        if(!last.empty() && (mi.top != last_top || !(mi.keys[mi.top] == last[last_top]))){
+            if(stats)
+                root->count(stats->expression);
+            sink.tree(root, tree_kind::stream_part);
+            root = new_tree(sink, spill);
+        }
+        last_ids = mi.ids;
+        last = mi.keys;
+        for(symbol_key& k : last)
+            k.ids = last_ids.data() + (k.ids - mi.ids.data());
+        last_top = mi.top;
+        
+        mi.parse_body(root, parser);
+        if(!mi.next_term(parser, selector))
+            continue;
+        
+        if(compare_keys(parser, mi.keys, last) < 0){
+            std::cerr << "WARNING: bracket \"" << parser.text(mi.keys[mi.top]) << "\" out of order in "
+                      << mi.path << ", merging the rest of the expression unsorted" << std::endl;
+            mi.parse_body(root, parser);
+            for(; !heap.empty(); heap.pop())
+                inputs[heap.top()]->parse_body(root, parser);
+            merge_hashed(inputs, parser, selector, root);
+            return root;
+        }
+        heap.push(i);
+    }
+    return root;
+}
+
+/*
+ * Reads the inputs of merge mode and passes the merged result to sink, in the same
+ * way as parse_input() does for a single input. If sorted is set, the expressions
+ * are merged by merge_sorted() and passed on in parts, and otherwise by
+ * merge_hashed(). All inputs must have the same number of tagged expressions. A
+ * mem_limit is applied as by parse_input().
+ */
+void parse_merged(std::vector< std::unique_ptr<merge_input> >& inputs, const symbol_classifier& classifier,
+                  bool sorted, parse_sink& sink, const bracket_selection* select = nullptr,
+                  size_t mem_limit = 0, run_stats* stats = nullptr)
+{
+    key_parser parser(classifier);
+    std::unique_ptr<key_selector> selector(select ? new key_selector(*select) : nullptr);
+    std::unique_ptr<content_spill> spill(mem_limit ? new content_spill(mem_limit) : nullptr);
+    
+    //Adds the input read so far to the statistics
+    auto count_input = [&]{
+        uint64_t bytes = 0, lines = 0;
+        double seconds = 0;
+        for(auto& mi : inputs){
+            bytes += mi->in->bytes_read();
+            lines += mi->in->lines_read();
+            seconds += mi->in->read_seconds();
+        }
+        stats->input(bytes, lines, seconds);
+    };
+    
+    for(;;){
+        size_t n_started = 0;
+        for(size_t i = 0; i < inputs.size(); i++)
+            n_started += inputs[i]->next_expression(i == 0 ? &sink : nullptr);
+        if(n_started == 0)
+            break;
+        
+        for(auto& mi : inputs){
+            if(!mi->at_term)
+                throw std::runtime_error("ERROR: " + mi->path + " has fewer expressions than the other inputs");
+            if(mi->name != inputs[0]->name)
+                throw std::runtime_error("ERROR: expression \"" + mi->name + "\" in " + mi->path
+                                         + " does not match \"" + inputs[0]->name + "\" in "
+                                         + inputs[0]->path);
+        }
+        
+        if(stats)
+            stats->begin_expression();
+        bracket* root = new_tree(sink, spill.get());
+        if(sorted)
+            root = merge_sorted(inputs, parser, selector.get(), root, sink, spill.get(), stats);
+        else
+            merge_hashed(inputs, parser, selector.get(), root);
+        if(stats){
+            root->count(stats->expression);
+            count_input();
+        }
+        sink.tree(root, tree_kind::expression);
+        
+        //No keys are held between expressions
+        bool forgotten = parser.trim();
+        if(selector)
+            selector->trim(forgotten);
+    }
+    if(stats)
+        count_input();
+}
+
+/*
+ * Prints the text and trees produced by parse_input() to dest: as text, with the
+ * trees laid out through out (which should write to dest), or in a structured
+ * format, in which case text is collected and written as one record before each
+ * tree. The output is framed by start() and finish(). If index is set (text
+ * only), the expressions and brackets are added to it as they are printed.
+ */
+struct expression_printer {
+    std::ostream& dest;
+    indent_stream& out;
+    bool streaming;
+    output_format format;
+    stream_state stream;
+    size_t column;
+    
+    json_tree_writer json;
+    bin_tree_writer bin;
+    std::string pending;            //text not yet written (structured formats)
+    std::string name;               //name of the current expression (structured formats, index)
+    output_index_writer* index;
+    run_stats* stats;               //null unless collecting statistics
+    
+    expression_printer(std::ostream& d, indent_stream& o, bool s, output_format f = output_format::text)
+    : dest(d), out(o), streaming(s), format(f), stream(), column(0), json(d), bin(d), pending(), name(),
+      index(nullptr), stats(nullptr) {};
+    
+    //Starts the output
+    void start(){
+        if(format == output_format::bin)
+            bin.start();
+    }
+    
+    //Prints text unchanged. The next expression continues on its last line.
+    void text(std::string_view s){
+        if(format != output_format::text){
+            pending += s;
+            return;
+        }
+        
+        dest << s;
+        size_t nl = s.rfind('\n');
+        column = (nl == std::string_view::npos) ? column + s.length() : s.length() - nl - 1;
+        out.set_column(column).advance(s.length());
+        if(index)
+            find_name(s);
+    }
+    
+    void print(const bracket* root, tree_kind kind){
+        {
+            stats_timer timer(stats ? &stats->expression.print : nullptr);
+            if(format == output_format::text)
+                print_tree(root, kind);
+            else{
+                flush_text();
+                if(format == output_format::json)
+                    write_tree(json, root, kind);
+                else
+                    write_tree(bin, root, kind);
+            }
+        }
+        if(stats && kind != tree_kind::stream_part)
+            stats->end_expression();
+    }
+    
+    //Writes the text printed so far, in a structured format
+    void flush_text(){
+        if(pending.empty())
+            return;
+        
+        find_name(pending);
+        if(format == output_format::json)
+            json.text(pending);
+        else
+            bin.text(pending);
+        pending.clear();
+    }
+    
+    //Ends the output
+    void finish(){
+        if(format == output_format::text)
+            dest << "\n";
+        else
+            flush_text();
+    }
+    
+private:
+    //The last line of text that is not blank may name the next expression
+    void find_name(std::string_view s){
+        size_t end = s.find_last_not_of(" \t\n");
+        if(end == std::string_view::npos)
+            return;
+        
+        size_t begin = s.rfind('\n', end);
+        begin = (begin == std::string_view::npos) ? 0 : begin + 1;
+        name = term_lexer::expression_name(s.substr(begin, end + 1 - begin));
+    }
+    
+    void print_tree(const bracket* root, tree_kind kind){
+        static constexpr std::string_view error_note = "Error occurred, printing results so far:\n";
+        
+        if(index && !index->in_expression())
+            index->begin(name);
+        
+        switch(kind){
+            case tree_kind::stream_part:
+                root->stream_print(out, stream, index);
+                break;
+                
+            case tree_kind::expression:
+                if(streaming)
+                    root->stream_finish(out, stream, index);
+                else
+                    root->print(out, true, index);
+                out << ";";
+                if(index)
+                    index->end();
+                out.flush();
+                stream.reset();
+                break;
+                
+            case tree_kind::unfinished:
+                dest << error_note;
+                out.advance(error_note.length());
+                if(streaming)
+                    root->stream_finish(out, stream, index);
+                else
+                    root->print(out, true, index);
+                if(index)
+                    index->end();
+                out.flush();
+                break;
+        }
+        
+        if(index){
+            index->update();
+            if(kind != tree_kind::stream_part)
+                name.clear();
+        }
+    }
+    
+    template< typename Writer >
+    void write_tree(Writer& w, const bracket* root, tree_kind kind){
+        static const record_type types[] = {record_type::part, record_type::expression,
+                                            record_type::unfinished};
+        w.begin_tree(types[size_t(kind)], name);
+        root->write(w);
+        w.end_tree();
+        if(kind != tree_kind::stream_part)
+            name.clear();
+    }
+};
+
+//Prints everything as soon as it is parsed, reusing one arena
+struct direct_sink : parse_sink {
+    expression_printer& printer;
+    arena mem;
+    
+    direct_sink(expression_printer& p) : printer(p), mem() {};
+    
+    void text(std::string_view lines){
+        printer.text("\n");
+        printer.text(lines);
+    }
+    arena& new_arena(){
+        mem.release();
+        return mem;
+    }
+    void tree(const bracket* root, tree_kind kind){
+        printer.print(root, kind);
+    }
+};
+
+/*
+ * Pipelined processing: one thread reads input in blocks, one parses it, and the
+ * calling thread prints the results. The threads are connected by bounded queues,
+ * so that reading continues (and the program writing the input does not block)
+ * while a large expression is being printed, and vice versa.
+ */
+struct print_item {
+    std::string text;               //text to print before the tree, if any
+    std::unique_ptr<arena> mem;     //arena holding the tree
+    const bracket* root;
+    tree_kind kind;
+};
+
+struct pipeline_sink : parse_sink {
+    static constexpr size_t text_chunk = size_t(1) << 16;
+    
+    spsc_queue<print_item>& items;
+    spsc_queue< std::unique_ptr<arena> >& spare;    //arenas returned by the printer
+    std::unique_ptr<arena> current;
+    std::string pending;
+    
+    pipeline_sink(spsc_queue<print_item>& i, spsc_queue< std::unique_ptr<arena> >& s)
+    : items(i), spare(s), current(), pending() {};
+    
+    void push(print_item&& item){
+        if(!items.push(std::move(item)))
+            throw std::runtime_error("ERROR: output stopped");
+    }
+    void flush_text(){
+        if(!pending.empty())
+            push(print_item{std::move(pending), nullptr, nullptr, tree_kind::expression});
+        pending.clear();
+    }
+    
+    void text(std::string_view lines){
+        pending += '\n';
+        pending += lines;
+        if(pending.length() >= text_chunk)
+            flush_text();
+    }
+    arena& new_arena(){
+        if(!spare.try_pop(current))
+            current.reset(new arena());
+        return *current;
+    }
+    void tree(const bracket* root, tree_kind kind){
+        push(print_item{std::move(pending), std::move(current), root, kind});
+        pending.clear();
+    }
+};
+
+void run_pipeline(decompressing_reader& input, const symbol_classifier& classifier, bool streaming,
+                  expression_printer& printer, const bracket_selection* select = nullptr,
+                  bool share = false)
+{
+    static constexpr size_t read_size = size_t(1) << 18;
+    
+    spsc_queue< std::vector<char> > blocks(16);
+    spsc_queue<print_item> items(8);
+    spsc_queue< std::unique_ptr<arena> > spare(16);     //more than can be in use at once
+    std::exception_ptr parse_error;
+    std::exception_ptr read_error;
+    
+    //The reader also decompresses the input, if necessary
+    std::thread reader([&]{
+        try{
+            for(;;){
+                std::vector<char> block(read_size);
+                size_t n = input.read(block.data(), block.size());
+                if(n == 0)
+                    break;
+                
+                block.resize(n);
+                if(!blocks.push(std::move(block)))
+                    break;
+            }
+        } catch (...) {
+            read_error = std::current_exception();
+        }
+        blocks.close();
+    });
+    
+    std::thread parser([&]{
+        std::vector<char> block;
+        size_t used = 0;
+        line_reader in([&](char* buf, size_t n) -> size_t {
+            while(used == block.size()){
+                if(!blocks.pop(block))
+                    return 0;
+                used = 0;
+            }
+            n = std::min(n, block.size() - used);
+            std::memcpy(buf, block.data() + used, n);
+            used += n;
+            return n;
+        });
+        
+        pipeline_sink sink(items, spare);
+        try{
+            parse_input(in, classifier, streaming, sink, select, 0, share);
+        } catch (...) {
+            parse_error = std::current_exception();
+        }
+        try{
+            sink.flush_text();
+        } catch (...) {}
+        items.close();
+        blocks.close();
+    });
+    
+    try{
+        for(print_item item; items.pop(item); ){
+            printer.text(item.text);
+            if(item.root)
+                printer.print(item.root, item.kind);
+            
+            if(item.mem){
+                item.mem->release();
+                spare.push(std::move(item.mem));
+            }
+        }
+    } catch (...) {
+        items.close();
+        blocks.close();
+        input.cancel();
+        parser.join();
+        reader.join();
+        throw;
+    }
+    
+    parser.join();
+    //The reader may be blocked on input that will never come if parsing failed
+    if(parse_error)
+        input.cancel();
+    reader.join();
+    //A read error ends the input early, so it is the cause of any parse error
+    if(read_error)
+        std::rethrow_exception(read_error);
+    if(parse_error)
+        std::rethrow_exception(parse_error);
+}
+
+/*
+ * Follow mode: formats a file while it is being written (see follow_reader). The
+ * file is parsed in one pass as it grows, so the lexer and any unfinished tree are
+ * simply kept waiting for more input, and whenever there is none, what has been
+ * printed so far is flushed. SIGINT and SIGTERM end the input as if the file ended
+ * there.
+ */
+void follow_input(const std::string& path, const symbol_classifier& classifier, bool streaming,
+                  expression_printer& printer, const bracket_selection* select = nullptr,
+                  size_t mem_limit = 0, bool share = false)
+{
+    follow_reader file(path, [&]{
+        printer.flush_text();
+        //Outside a streamed expression, out may hold text that must come after the
+        //text written directly to dest
+        if(printer.stream.started)
+            printer.out.flush();
+        printer.dest.flush();
+    });
+
+    //A signal may have stopped an earlier run in this process
+    follow_reader::restart();
+    struct sigaction stop = {}, old_int, old_term;
+    stop.sa_handler = [](int){ follow_reader::stop(); };
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, &old_int);
+    sigaction(SIGTERM, &stop, &old_term);
+    auto restore = [&]{
+        sigaction(SIGINT, &old_int, nullptr);
+        sigaction(SIGTERM, &old_term, nullptr);
+    };
+
+    try{
+        line_reader in([&](char* buf, size_t n){ return file.read(buf, n); });
+        direct_sink sink(printer);
+        parse_input(in, classifier, streaming, sink, select, mem_limit, share, printer.stats);
+    } catch (...) {
+        restore();
+        throw;
+    }
+    restore();
+}
+
+/*
+ * Batch mode: formats many files in parallel on a work_pool, sharing the symbol
+ * table read-only. Files larger than batch_piece_size are cut into pieces right
+ * after the end of an expression (a line ending with a semicolon), which are
+ * formatted as separate tasks and joined in order. Since nothing carries over
+ * from one expression to the next, the result is the same as for the whole file.
+ */
+static constexpr size_t batch_piece_size = size_t(1) << 22;
+
+struct batch_settings {
+    const symbol_classifier& classifier;
+    const bracket_selection* select;
+    bool streaming;
+    output_format format;
+    std::atomic<bool> failed;
+};
+
+struct batch_file {
+    std::string in_path;
+    std::string out_path;
+    std::unique_ptr<line_reader> in;
+    std::ofstream out;
+    
+    //For split files: the pieces are written in order as soon as they and all
+    //before them are formatted, up to the first one that failed
+    std::vector<std::string_view> pieces;
+    std::atomic<size_t> next_piece{0};      //first piece that no task has taken
+    std::mutex m;
+    std::vector<std::string> outputs;       //formatted pieces not written yet
+    std::vector<std::string> errors;        //empty if the piece was formatted
+    std::vector<bool> done;
+    size_t written = 0;                     //pieces written (or skipped after an error)
+    std::string error;                      //of the first piece that failed
+};
+
+//Position after the first line ending with a semicolon at or after pos, or npos
+size_t expression_end(std::string_view text, size_t pos){
+    while(pos < text.length()){
+        const char* semi = static_cast<const char*>(
+            std::memchr(text.data() + pos, ';', text.length() - pos));
+        if(!semi)
+            break;
+        
+        pos = semi - text.data() + 1;
+        while(pos < text.length() && text[pos] != '\n' && std::isspace(text[pos]))
+            pos++;
+        if(pos == text.length())
+            return pos;
+        if(text[pos] == '\n')
+            return pos + 1;
+    }
+    return std::string_view::npos;
+}
+
+//Formats one piece of a file to os, as main() would print it if the piece were
+//all of its input, but with the surrounding newlines only where the whole file
+//begins or ends
+void format_piece(line_reader& in, const batch_settings& settings, bool first, bool last,
+                  std::ostream& os)
+{
+    indent_stream out(os, 0, 3, 8, -2, 79);
+    expression_printer printer(os, out, settings.streaming, settings.format);
+    if(first)
+        printer.start();
+    
+    try{
+        direct_sink sink(printer);
+        parse_input(in, settings.classifier, settings.streaming, sink, settings.select);
+    } catch (std::runtime_error&) {
+        printer.finish();
+        out.flush();
+        throw;
+    }
+    if(last)
+        printer.finish();
+    else
+        printer.flush_text();
+    out.flush();
+}
+
+//Formats a piece of a split file into a string, which is written by piece_done()
+void format_piece(line_reader& in, const batch_settings& settings, bool first, bool last,
+                  std::string& output)
+{
+    std::ostringstream os;
+    try{
+        format_piece(in, settings, first, last, static_cast<std::ostream&>(os));
+    } catch (...) {
+        output = os.str();
+        throw;
+    }
+    output = os.str();
+}
+
+//Drops the pages of a formatted piece of a mapped file from memory (they are read
+//from the file again if touched)
+void release_piece(std::string_view piece){
+    uintptr_t page = uintptr_t(::sysconf(_SC_PAGESIZE));
+    uintptr_t begin = (uintptr_t(piece.data()) + page - 1) / page * page;
+    uintptr_t end = (uintptr_t(piece.data()) + piece.length()) / page * page;
+    if(begin < end)
+        ::madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+}
+
+//Closes the output of a file, and reports the error if it failed
+void finish_batch_file(batch_file& file, batch_settings& settings){
+    file.out.close();
+    if(!file.out && file.error.empty())
+        file.error = "ERROR: could not write " + file.out_path;
+    if(!file.error.empty()){
+        std::cerr << (file.in_path + ": " + file.error + "\n");
+        settings.failed = true;
+    }
+    file.in.reset();
+}
+
+//Marks piece i of a split file as formatted, and writes out all pieces that can be
+//written now, freeing them
+void piece_done(batch_file& file, batch_settings& settings, size_t i){
+    std::lock_guard<std::mutex> lock(file.m);
+    file.done[i] = true;
+    
+    size_t n = file.outputs.size();
+    while(file.written < n && file.done[file.written]){
+        size_t j = file.written++;
+        if(file.error.empty()){
+            file.out << file.outputs[j];
+            file.error = file.errors[j];
+        }
+        std::string().swap(file.outputs[j]);
+    }
+    if(file.written == n)
+        finish_batch_file(file, settings);
+}
+
+void format_batch_file(work_pool& pool, batch_file& file, batch_settings& settings){
+    try{
+        file.in.reset(new line_reader(file.in_path));
+    } catch (std::runtime_error& e) {
+        std::cerr << (file.in_path + ": " + e.what() + "\n");
+        settings.failed = true;
+        return;
+    }
+    
+    //Only mapped files can be split
+    std::string_view all = file.in->contents();
+    std::vector<std::string_view> pieces;
+    size_t begin = 0;
+    while(all.length() - begin > batch_piece_size){
+        size_t end = expression_end(all, begin + batch_piece_size);
+        if(end == std::string_view::npos || end == all.length())
+            break;
+        
+        pieces.push_back(all.substr(begin, end - begin));
+        begin = end;
+    }
+    if(!pieces.empty())
+        pieces.push_back(all.substr(begin));
+    
+    file.out.open(file.out_path, std::ios::binary);
+    
+    //An unsplit file is formatted straight into its output
+    if(pieces.empty()){
+        try{
+            format_piece(*file.in, settings, true, true, static_cast<std::ostream&>(file.out));
+        } catch (std::runtime_error& e) {
+            file.error = e.what();
+        }
+        finish_batch_file(file, settings);
+        return;
+    }
+    
+    size_t n = pieces.size();
+    file.outputs.resize(n);
+    file.errors.resize(n);
+    file.done.assign(n, false);
+    
+    file.pieces = std::move(pieces);
+    
+    //Each task formats the next piece that nobody has taken yet, so the pieces finish
+    //(and are written and freed) nearly in order, whichever threads take part
+    for(size_t k = 0; k < std::min(n, pool.size()); k++){
+        pool.submit([&file, &settings, n]{
+            for(size_t i; (i = file.next_piece++) < n; ){
+                line_reader in(file.pieces[i].data(), file.pieces[i].length());
+                try{
+                    format_piece(in, settings, i == 0, i == n - 1, file.outputs[i]);
+                } catch (std::runtime_error& e) {
+                    file.errors[i] = e.what();
+                }
+                release_piece(file.pieces[i]);
+                piece_done(file, settings, i);
+            }
+        });
+    }
+}
+
+/*
+ * Lists the files for batch mode: the files in the directory src (except hidden
+ * ones and earlier output), or the files named in the file src, one per line and
+ * optionally followed by a tab and the output path. By default, output goes to
+ * the input path with .mb appended, or to the same name in out_dir.
+ */
+std::vector< std::unique_ptr<batch_file> > list_batch_files(const std::string& src,
+                                                            const std::string& out_dir)
+{
+    std::vector< std::pair<std::string, std::string> > paths;
+    
+    struct stat st;
+    if(::stat(src.c_str(), &st) != 0)
+        throw std::runtime_error("ERROR: could not open " + src);
+    
+    if(S_ISDIR(st.st_mode)){
+        DIR* dir = ::opendir(src.c_str());
+        if(!dir)
+            throw std::runtime_error("ERROR: could not open " + src);
+        
+        for(struct dirent* entry; (entry = ::readdir(dir)); ){
+            std::string name(entry->d_name);
+            if(name[0] == '.' || (name.length() > 3 && name.compare(name.length() - 3, 3, ".mb") == 0))
+                continue;
+            
+            std::string path = src + "/" + name;
+            if(::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                paths.emplace_back(path, "");
+        }
+        ::closedir(dir);
+        std::sort(paths.begin(), paths.end());
+    }
+    else{
+        line_reader list(src);
+        for(std::string_view line; list.getline(line); ){
+            size_t tab = line.find('\t');
+            std::string in(line.substr(0, tab));
+            std::string out(tab == std::string_view::npos ? "" : line.substr(tab + 1));
+            if(!in.empty())
+                paths.emplace_back(in, out);
+        }
+    }
+    
+    if(!out_dir.empty())
+        ::mkdir(out_dir.c_str(), 0777);
+    
+    std::vector< std::unique_ptr<batch_file> > files;
+    for(auto& [in, out] : paths){
+        if(out.empty())
+            out = out_dir.empty() ? in + ".mb" : out_dir + "/" + in.substr(in.rfind('/') + 1);
+        if(out == in)
+            throw std::runtime_error("ERROR: output would overwrite " + in);
+        
+        files.emplace_back(new batch_file());
+        files.back()->in_path = in;
+        files.back()->out_path = out;
+    }
+    return files;
+}
+
+/*
+ * Prints the expressions or brackets given by path (a name, followed by keys) from
+ * the output file out_path, using the index written for it with --index. Only their
+ * byte ranges are read.
+ */
+void run_lookup(const std::string& out_path, const std::string& index_path,
+                const std::vector<std::string>& path)
+{
+    std::vector< std::pair<uint64_t, uint64_t> > ranges;
+    {
+        line_reader index(index_path);
+        ranges = find_in_index(index, path);
+    }
+    if(ranges.empty()){
+        std::string p;
+        for(const std::string& k : path)
+            p += (p.empty() ? "" : " ") + k;
+        throw std::runtime_error("ERROR: \"" + p + "\" not found in " + index_path);
+    }
+    
+    int fd = ::open(out_path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error("ERROR: could not open " + out_path + ": " + std::strerror(errno));
+    
+    std::vector<char> buf(size_t(1) << 20);
+    for(auto [start, end] : ranges){
+        while(start < end){
+            ssize_t n = ::pread(fd, buf.data(), std::min<uint64_t>(buf.size(), end - start), off_t(start));
+            if(n <= 0){
+                ::close(fd);
+                throw std::runtime_error("ERROR: " + out_path + " does not match " + index_path);
+            }
+            std::cout.write(buf.data(), n);
+            start += n;
+        }
+        std::cout << "\n";
+    }
+    ::close(fd);
+}
+
+//Returns the exit status
+int run_batch(const std::string& src, const std::string& out_dir, size_t jobs,
+              const symbol_classifier& classifier, const bracket_selection* select,
+              bool streaming, output_format format)
+{
+    std::vector< std::unique_ptr<batch_file> > files = list_batch_files(src, out_dir);
+    batch_settings settings{classifier, select, streaming, format, {false}};
+    
+    work_pool pool(jobs ? jobs : std::thread::hardware_concurrency());
+    for(auto& file : files)
+        pool.submit([&pool, &file = *file, &settings]{ format_batch_file(pool, file, settings); });
+    pool.wait();
+    
+    return settings.failed ? 1 : 0;
+}
+
+
+} //namespace
+
+/*
+ * The library interface (see multibracket.hpp).
+ */
+multibracket_spec::multibracket_spec(const std::vector<std::string>& levels,
+                                     const std::vector<std::string>& selected,
+                                     bool form_ranges, const std::string& cache_dir)
+: cls(), select()
+{
+    flat_insertion_order_map< std::string, size_t > br_symbols;
+    
+    //The cache is keyed by everything that affects the result
+    std::vector<std::string> cache_key = levels;
+    if(form_ranges)
+        cache_key.push_back("--form-ranges");
+    spec_cache cache(cache_dir, cache_key);
+    
+    if(cache_dir.empty() || !cache.load(br_symbols)){
+        for(size_t lvl = 0; lvl < levels.size(); lvl++)
+            parse_bracket_symbols(lvl, levels[lvl], br_symbols, form_ranges);
+        
+        if(!cache_dir.empty())
+            cache.store(br_symbols);
+    }
+    cls.reset(new symbol_classifier(br_symbols, levels.size()));
+    if(!selected.empty())
+        select.reset(new bracket_selection(selected, levels.size()));
+}
+
+multibracket_spec::~multibracket_spec() = default;
+
+namespace {
+
+//Reports the trees of parse_input() to a multibracket_events handler, walking them
+//as a writer for bracket::write()
+struct event_sink : parse_sink {
+    multibracket_events& events;
+    arena mem;
+    std::string name;               //name of the next expression, if announced
+    bool in_expression;
+    size_t depth;
+    
+    event_sink(multibracket_events& e) : events(e), mem(), name(), in_expression(false), depth(0) {};
+    
+    void text(std::string_view lines){
+        for(size_t start = 0;; ){
+            size_t nl = lines.find('\n', start);
+            events.text(lines.substr(start, nl - start));
+            if(nl == std::string_view::npos)
+                break;
+            start = nl + 1;
+        }
+        std::string_view line = term_lexer::last_line(lines);
+        if(!line.empty())
+            name = term_lexer::expression_name(line);
+    }
+    arena& new_arena(){
+        mem.release();
+        return mem;
+    }
+    void tree(const bracket* root, tree_kind kind){
+        if(!in_expression){
+            events.expression_begin(name);
+            in_expression = true;
+        }
+        root->write(*this);
+        if(kind != tree_kind::stream_part){
+            events.expression_end(kind == tree_kind::expression);
+            in_expression = false;
+            name.clear();
+        }
+    }
+    
+    //The root is the expression itself, not a bracket
+    void begin_node(std::string_view key, size_t, size_t){
+        if(depth++ > 0)
+            events.bracket_enter(key);
+    }
+    void content(std::string_view line){
+        events.body_line(line);
+    }
+    void end_content(){}
+    void end_node(){
+        if(--depth > 0)
+            events.bracket_leave();
+    }
+};
+
+//Stream buffer that passes everything on to an output_sink (indent_stream buffers
+//its output itself)
+class output_sink_buf : public std::streambuf {
+private:
+    output_sink& out;
+    
+protected:
+    int_type overflow(int_type c) override {
+        if(!traits_type::eq_int_type(c, traits_type::eof())){
+            char ch = traits_type::to_char_type(c);
+            out.write(&ch, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        out.write(s, size_t(n));
+        return n;
+    }
+    int sync() override {
+        out.flush();
+        return 0;
+    }
+    
+public:
+    explicit output_sink_buf(output_sink& o) : out(o) {};
+};
+
+} //namespace
+
+/*
+ * The parser runs parse_input() in a thread of its own, reading from a line_reader
+ * whose input function waits for the buffers passed to feed(). feed() waits in
+ * turn until all of its buffer has been consumed and the parser is waiting for
+ * more, so that the two threads never run at the same time, and the parser keeps
+ * all of its state (that of the lexer, and any unfinished tree) between calls.
+ * Since the parser can do nothing with part of a line, feed() keeps an unfinished
+ * line to itself until its end arrives, so the threads switch at most once per
+ * line however small the buffers are.
+ */
+struct multibracket_parser::impl {
+    const multibracket_spec& spec;
+    bool streaming;
+    
+    //Where the trees go: either events, or a printer writing to an output_sink
+    std::unique_ptr<event_sink> events;
+    std::unique_ptr<output_sink_buf> buf;
+    std::unique_ptr<std::ostream> os;
+    std::unique_ptr<indent_stream> out;
+    std::unique_ptr<expression_printer> printer;
+    std::unique_ptr<direct_sink> printing;
+    
+    std::mutex m;
+    std::condition_variable cv;
+    const char* data;               //rest of the buffer being fed
+    size_t left;
+    bool waiting;                   //whether the parser is waiting for input
+    bool closed;                    //whether the input has ended
+    bool aborted;                   //whether the parser should stop at once
+    bool done;                      //whether the parser has stopped
+    std::exception_ptr error;
+    std::string held;               //start of a line fed but not yet passed on
+    std::thread thread;
+    
+    struct abort_parsing {};
+    
+    //Partial lines longer than this are passed on without waiting for their end
+    static constexpr size_t hand_size = size_t(1) << 16;
+    
+    impl(const multibracket_spec& s, bool st)
+    : spec(s), streaming(st), events(), buf(), os(), out(), printer(), printing(), m(), cv(),
+      data(nullptr), left(0), waiting(false), closed(false), aborted(false), done(false), error(),
+      held(), thread() {};
+    
+    //The input function of the parser's line_reader
+    size_t take(char* dest, size_t n){
+        std::unique_lock<std::mutex> lock(m);
+        while(left == 0 && !closed && !aborted){
+            waiting = true;
+            cv.notify_all();
+            cv.wait(lock);
+        }
+        waiting = false;
+        if(aborted)
+            throw abort_parsing();
+        
+        n = std::min(n, left);
+        std::memcpy(dest, data, n);
+        data += n;
+        left -= n;
+        return n;
+    }
+    
+    void start(parse_sink& sink){
+        thread = std::thread([this, &sink]{
+            try{
+                line_reader in([this](char* dest, size_t n){ return take(dest, n); });
+                parse_input(in, spec.classifier(), streaming, sink, spec.selection());
+            } catch (abort_parsing&) {
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(m);
+            done = true;
+            cv.notify_all();
+        });
+    }
+    
+    //Waits until the parser has consumed everything and wants more, or has stopped
+    void wait(std::unique_lock<std::mutex>& lock){
+        cv.wait(lock, [this]{ return done || (left == 0 && waiting); });
+    }
+    
+    //Passes a buffer to the parser, and waits until it has consumed all of it
+    void hand(const char* d, size_t n){
+        std::unique_lock<std::mutex> lock(m);
+        if(closed)
+            throw std::runtime_error("ERROR: input fed to a parser after its end");
+        if(error)
+            std::rethrow_exception(error);
+        
+        data = d;
+        left = n;
+        waiting = false;
+        cv.notify_all();
+        wait(lock);
+        left = 0;
+        
+        if(error)
+            std::rethrow_exception(error);
+    }
+};
+
+multibracket_parser::multibracket_parser(const multibracket_spec& spec, multibracket_events& events,
+                                         bool streaming)
+: p(new impl(spec, streaming))
+{
+    p->events.reset(new event_sink(events));
+    p->start(*p->events);
+}
+
+multibracket_parser::multibracket_parser(const multibracket_spec& spec, output_sink& out,
+                                         bool streaming, output_format format)
+: p(new impl(spec, streaming))
+{
+    p->buf.reset(new output_sink_buf(out));
+    p->os.reset(new std::ostream(p->buf.get()));
+    p->out.reset(new indent_stream(*p->os, 0, 3, 8, -2, 79));
+    p->printer.reset(new expression_printer(*p->os, *p->out, streaming, format));
+    p->printing.reset(new direct_sink(*p->printer));
+    p->printer->start();
+    p->start(*p->printing);
+}
+
+multibracket_parser::~multibracket_parser(){
+    if(p->thread.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(p->m);
+            p->aborted = true;
+            p->cv.notify_all();
+        }
+        p->thread.join();
+    }
+}
+
+void multibracket_parser::feed(const char* data, size_t n){
+    if(n == 0){
+        std::lock_guard<std::mutex> lock(p->m);
+        if(p->closed)
+            throw std::runtime_error("ERROR: input fed to a parser after its end");
+        return;
+    }
+    
+    //The parser can only get on with complete lines, so a partial line is kept
+    //(unless it grows long) until the rest of it arrives
+    const char* nl = static_cast<const char*>(::memrchr(data, '\n', n));
+    if(!nl && p->held.length() + n < impl::hand_size){
+        std::lock_guard<std::mutex> lock(p->m);
+        if(p->closed)
+            throw std::runtime_error("ERROR: input fed to a parser after its end");
+        if(p->error)
+            std::rethrow_exception(p->error);
+        p->held.append(data, n);
+        return;
+    }
+    
+    size_t whole = nl ? nl + 1 - data : n;
+    if(p->held.empty())
+        p->hand(data, whole);
+    else{
+        p->held.append(data, whole);
+        p->hand(p->held.data(), p->held.length());
+        p->held.clear();
+    }
+    p->held.append(data + whole, n - whole);
+}
+
+void multibracket_parser::finish(){
+    if(!p->held.empty()){
+        std::string rest;
+        rest.swap(p->held);
+        p->hand(rest.data(), rest.length());
+    }
+    {
+        std::unique_lock<std::mutex> lock(p->m);
+        if(p->closed)
+            return;
+        p->closed = true;
+        p->cv.notify_all();
+        p->cv.wait(lock, [this]{ return p->done; });
+    }
+    p->thread.join();
+    
+    if(p->printer){
+        p->printer->finish();
+        p->out->flush();
+        p->os->flush();
+    }
+    if(p->error)
+        std::rethrow_exception(p->error);
+}
+
+int run_multibracket(const multibracket_options& opts){
+    run_stats::clock::time_point setup_start = run_stats::clock::now();
+    bool pipeline = opts.pipeline;
+    
+    //The parameters of a lookup are a path in the index rather than specifications
+    if(!opts.lookup_path.empty()){
+        if(opts.specs.empty()){
+            std::cerr << "ERROR: --lookup needs the name of an expression" << std::endl;
+            return 1;
+        }
+        try{
+            run_lookup(opts.lookup_path, opts.index_path.empty() ? opts.lookup_path + ".idx" : opts.index_path,
+                       opts.specs);
+        } catch (std::runtime_error& e) {
+            std::cout.flush();
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    
+    std::unique_ptr<multibracket_spec> spec;
+    try{
+        spec.reset(new multibracket_spec(opts.specs, opts.selected, opts.form_ranges, opts.cache_dir));
+    } catch (std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    const symbol_classifier& classifier = spec->classifier();
+    const bracket_selection* select = spec->selection();
+    
+    if(opts.with_stats && !opts.batch_src.empty()){
+        std::cerr << "ERROR: --stats can not be used with --batch" << std::endl;
+        return 1;
+    }
+    if(!opts.index_path.empty() && (!opts.batch_src.empty() || opts.format != output_format::text)){
+        std::cerr << "ERROR: --index can only be used with text output, and not with --batch" << std::endl;
+        return 1;
+    }
+    //The binary format collects each tree in memory before writing it
+    if(opts.mem_limit && (!opts.batch_src.empty() || opts.format == output_format::bin)){
+        std::cerr << "ERROR: --mem-limit can not be used with --batch or --format=bin" << std::endl;
+        return 1;
+    }
+    if(!opts.merged.empty() && !opts.batch_src.empty()){
+        std::cerr << "ERROR: --merge can not be used with --batch" << std::endl;
+        return 1;
+    }
+    if(!opts.follow_path.empty() && (!opts.batch_src.empty() || !opts.merged.empty())){
+        std::cerr << "ERROR: --follow can not be used with --batch or --merge" << std::endl;
+        return 1;
+    }
+    if(opts.share && (opts.streaming || opts.mem_limit || !opts.batch_src.empty() || !opts.merged.empty())){
+        std::cerr << "ERROR: --share can not be used with --stream, --mem-limit, --batch or --merge" << std::endl;
+        return 1;
+    }
+    if(!opts.output_path.empty() && !opts.batch_src.empty()){
+        std::cerr << "ERROR: --output can not be used with --batch" << std::endl;
+        return 1;
+    }
+    if(!opts.index_path.empty() && codec_for_path(opts.output_path) != codec::none){
+        std::cerr << "ERROR: --index needs uncompressed output" << std::endl;
+        return 1;
+    }
+    if(opts.with_stats && pipeline){
+        std::cerr << "WARNING: --stats disables --pipeline" << std::endl;
+        pipeline = false;
+    }
+    if(!opts.merged.empty() && pipeline){
+        std::cerr << "WARNING: --merge disables --pipeline" << std::endl;
+        pipeline = false;
+    }
+    if(opts.mem_limit && pipeline){
+        std::cerr << "WARNING: --mem-limit disables --pipeline" << std::endl;
+        pipeline = false;
+    }
+    if(!opts.follow_path.empty() && pipeline){
+        std::cerr << "WARNING: --follow disables --pipeline" << std::endl;
+        pipeline = false;
+    }
+    
+    std::unique_ptr<run_stats> run_stats_ptr;
+    if(opts.with_stats){
+        try{
+            double setup = std::chrono::duration<double>(run_stats::clock::now() - setup_start).count();
+            run_stats_ptr.reset(new run_stats(setup, opts.stats_path));
+        } catch (std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    if(!opts.batch_src.empty()){
+        try{
+            return run_batch(opts.batch_src, opts.out_dir, opts.jobs, classifier, select, opts.streaming,
+                             opts.format);
+        } catch (std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    std::unique_ptr<compressed_ostream> output_file;
+    if(!opts.output_path.empty()){
+        try{
+            output_file.reset(new compressed_ostream(opts.output_path));
+        } catch (std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& dest = output_file ? *output_file : std::cout;
+    
+    indent_stream out(dest, 0, 3, 8, -2, 79);
+    expression_printer printer(dest, out, opts.streaming, opts.format);
+    printer.stats = run_stats_ptr.get();
+    
+    std::ofstream index_file;
+    std::unique_ptr<output_index_writer> index;
+    if(!opts.index_path.empty()){
+        index_file.open(opts.index_path);
+        if(!index_file){
+            std::cerr << "ERROR: could not open " << opts.index_path << std::endl;
+            return 1;
+        }
+        index.reset(new output_index_writer(index_file, out));
+        printer.index = index.get();
+    }
+    
+    //Writes out the rest of the output and of the index, returning false if that failed
+    auto close_output = [&]{
+        out.flush();
+        dest.flush();
+        bool written = true;
+        if(index){
+            index->update();
+            index_file.close();
+            if(!index_file){
+                std::cerr << "ERROR: could not write " << opts.index_path << std::endl;
+                written = false;
+            }
+        }
+        if(output_file){
+            try{
+                output_file->close();
+            } catch (std::runtime_error& e) {
+                std::cerr << e.what() << std::endl;
+                return false;
+            }
+        }
+        return written;
+    };
+    printer.start();
+    
+    try{
+        if(!opts.merged.empty()){
+            std::vector< std::unique_ptr<merge_input> > inputs;
+            for(const std::string& path : opts.merged)
+                inputs.emplace_back(new merge_input(path, printer.stats));
+            direct_sink sink(printer);
+            parse_merged(inputs, classifier, opts.streaming, sink, select, opts.mem_limit, printer.stats);
+        }
+        else if(!opts.follow_path.empty())
+            follow_input(opts.follow_path, classifier, opts.streaming, printer, select, opts.mem_limit,
+                         opts.share);
+        else{
+            decompressing_reader input(STDIN_FILENO);
+            if(pipeline)
+                run_pipeline(input, classifier, opts.streaming, printer, select, opts.share);
+            else{
+                std::unique_ptr<line_reader> in(input.passthrough()
+                    ? new line_reader(STDIN_FILENO)
+                    : new line_reader([&](char* buf, size_t n){ return input.read(buf, n); }));
+                direct_sink sink(printer);
+                parse_input(*in, classifier, opts.streaming, sink, select, opts.mem_limit, opts.share,
+                            printer.stats);
+            }
+        }
+    } catch (std::runtime_error& e) {
+        printer.finish();
+        close_output();
+        std::cerr << e.what() << std::endl;
+        if(printer.stats)
+            printer.stats->end_run();
+        return 1;
+    }
+    
+    printer.finish();
+    bool written = close_output();
+    if(printer.stats)
+        printer.stats->end_run();
+    return written ? 0 : 1;
+}
@@ -0,0 +1,272 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Reads lines from a file descriptor without copying them.
+ *
+ * If the file descriptor refers to a regular file, the whole file is mapped
+ * into memory and lines are handed out as @c std::string_view slices of the
+ * mapping, which stay valid for the lifetime of the reader. Otherwise (pipes,
+ * terminals etc.), input is read in large blocks into an internal buffer, and
+ * each slice stays valid only until the next call to @c getline.
+ *
+ * Input may also come from a function that fills a buffer, in which case it is
+ * buffered as for a pipe, or from a range of memory, which is used in place.
+ *
+ * Lines are split at @c '\n', which is not included in the slices. As with
+ * @c std::getline, a final line without a terminating newline is still returned.
+ */
+class line_reader {
+public:
+    static constexpr size_t block_size = size_t(1) << 22;
+    
+    //Reads up to n bytes into the buffer, returning the number read (0 at the end)
+    using read_function = std::function<size_t(char* buffer, size_t n)>;
+
+private:
+    int fd;
+    bool own_fd;
+
+    const char* data;       //start of valid input
+    size_t size;            //length of valid input
+    size_t pos;             //start of the next line
+
+    void* map;
+    size_t map_len;
+
+    std::vector<char> buffer;
+    bool eof;
+    
+    read_function source;
+
+    //Counters for statistics
+    uint64_t n_lines;
+    uint64_t discarded;     //bytes moved out of the buffer
+    double read_time;       //seconds spent waiting for input
+
+    void open_fd(){
+        struct stat st;
+        if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)){
+            if(st.st_size == 0){
+                eof = true;
+                return;
+            }
+
+            void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(m != MAP_FAILED){
+                madvise(m, st.st_size, MADV_SEQUENTIAL);
+                map = m;
+                map_len = st.st_size;
+                data = static_cast<const char*>(m);
+                size = map_len;
+                eof = true;
+                return;
+            }
+        }
+
+        //Not mappable, fall back to buffered reads
+        buffer.resize(block_size);
+        data = buffer.data();
+    }
+
+    //Moves the unread part of the buffer to its start and reads more input after it.
+    //Returns false if nothing more could be read.
+    bool refill(){
+        size_t left = size - pos;
+        discarded += pos;
+        if(pos > 0){
+            std::memmove(buffer.data(), buffer.data() + pos, left);
+            pos = 0;
+            size = left;
+        }
+        if(size == buffer.size())
+            buffer.resize(2 * buffer.size());
+        data = buffer.data();
+
+        auto start = std::chrono::steady_clock::now();
+        if(source){
+            size_t n = source(buffer.data() + size, buffer.size() - size);
+            size += n;
+            eof = (n == 0);
+        }
+        else{
+            for(;;){
+                ssize_t n = ::read(fd, buffer.data() + size, buffer.size() - size);
+                if(n > 0){
+                    size += n;
+                    break;
+                }
+                else if(n == 0 || errno != EINTR){
+                    eof = true;
+                    break;
+                }
+            }
+        }
+        read_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return !eof;
+    }
+
+public:
+    /**
+     * @brief Reads from an open file descriptor (default: standard input),
+     * which is not closed by the reader.
+     */
+    explicit line_reader(int f = STDIN_FILENO)
+    : fd(f), own_fd(false), data(nullptr), size(0), pos(0),
+      map(nullptr), map_len(0), buffer(), eof(false), source(),
+      n_lines(0), discarded(0), read_time(0)
+    {
+        open_fd();
+    }
+
+    /**
+     * @brief Reads whatever the given function supplies.
+     */
+    explicit line_reader(read_function f)
+    : fd(-1), own_fd(false), data(nullptr), size(0), pos(0),
+      map(nullptr), map_len(0), buffer(block_size), eof(false), source(f),
+      n_lines(0), discarded(0), read_time(0)
+    {
+        data = buffer.data();
+    }
+
+    /**
+     * @brief Reads from memory, which must stay valid for the lifetime of the reader.
+     */
+    line_reader(const char* text, size_t length)
+    : fd(-1), own_fd(false), data(text), size(length), pos(0),
+      map(nullptr), map_len(0), buffer(), eof(true), source(),
+      n_lines(0), discarded(0), read_time(0)
+    {}
+
+    /**
+     * @brief Opens and reads the file at the given path.
+     */
+    explicit line_reader(const std::string& path)
+    : fd(::open(path.c_str(), O_RDONLY)), own_fd(true), data(nullptr), size(0), pos(0),
+      map(nullptr), map_len(0), buffer(), eof(false), source(),
+      n_lines(0), discarded(0), read_time(0)
+    {
+        if(fd < 0)
+            throw std::runtime_error("ERROR: could not open " + path);
+        open_fd();
+    }
+
+    line_reader(const line_reader&) = delete;
+    line_reader& operator= (const line_reader&) = delete;
+
+    ~line_reader(){
+        if(map)
+            munmap(map, map_len);
+        if(own_fd)
+            ::close(fd);
+    }
+
+    /**
+     * @brief The whole input if it was mapped into memory, and otherwise an empty view.
+     */
+    std::string_view contents() const {
+        return map ? std::string_view(static_cast<const char*>(map), map_len) : std::string_view();
+    }
+
+    /**
+     * @brief Reads the next line into @p line.
+     *
+     * @return false if there is no more input, in which case @p line is empty.
+     */
+    bool getline(std::string_view& line){
+        for(;;){
+            const char* nl = pos < size
+                ? static_cast<const char*>(std::memchr(data + pos, '\n', size - pos))
+                : nullptr;
+
+            if(nl){
+                line = std::string_view(data + pos, nl - (data + pos));
+                pos = (nl - data) + 1;
+                n_lines++;
+                return true;
+            }
+
+            if(eof || !refill()){
+                //Unterminated final line
+                line = std::string_view(data + pos, size - pos);
+                pos = size;
+                n_lines += !line.empty();
+                return !line.empty();
+            }
+        }
+    }
+
+    /**
+     * @brief Reads all complete lines that are already available (the rest of a
+     * mapped file, or of the buffer), up to the first that starts with @p prefix,
+     * into @p text as one slice without its final newline. Lines are found with
+     * @c memmem rather than one by one, so this is much faster than @c getline
+     * for long stretches of input that are passed on unchanged.
+     *
+     * @return false if there is no such line, because the next line starts with
+     * @p prefix or is not complete yet, in which case nothing is read.
+     */
+    bool getlines_before(std::string_view prefix, std::string_view& text){
+        const char* p = data + pos;
+        const char* end = data + size;
+        if(p == end)
+            return false;
+
+        //End of the last line before the first one starting with prefix
+        const char* stop = nullptr;
+        for(const char* q = p; q < end; q++){
+            q = static_cast<const char*>(::memmem(q, end - q, prefix.data(), prefix.length()));
+            if(!q)
+                break;
+            if(q == p)
+                return false;
+            if(q[-1] == '\n'){
+                stop = q - 1;
+                break;
+            }
+        }
+        if(!stop){
+            //The incomplete last line, if any, may still turn out to start with prefix
+            stop = static_cast<const char*>(::memrchr(p, '\n', end - p));
+            if(!stop)
+                return false;
+        }
+
+        text = std::string_view(p, stop - p);
+        pos = (stop - data) + 1;
+        //memchr is much faster than std::count at this
+        n_lines++;
+        for(const char* q = p; (q = static_cast<const char*>(std::memchr(q, '\n', stop - q))); q++)
+            n_lines++;
+        return true;
+    }
+
+    /* Statistics */
+    uint64_t lines_read() const {
+        return n_lines;
+    }
+    uint64_t bytes_read() const {
+        return discarded + pos;
+    }
+    double read_seconds() const {
+        return read_time;
+    }
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef MULTIBRACKET_H
+#define MULTIBRACKET_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+/*
+ * libmultibracket: the multibracket formatter as a library (libmultibracket.a or
+ * libmultibracket.so, see the makefile). Programs can use it to read FORM output
+ * with multibracket tags in-process: a multibracket_parser is fed the output in
+ * buffers of any size, and either reports the structure of each expression to a
+ * multibracket_events handler, or formats it as multibracket itself does and
+ * writes the result to an output_sink.
+ *
+ * The multibracket command is a thin wrapper around run_multibracket().
+ */
+
+//The library is built with hidden symbols, except for those marked with this
+#define MULTIBRACKET_API __attribute__((visibility("default")))
+
+class symbol_classifier;
+class bracket_selection;
+
+//Output formats (see tree_writer.hpp for the structured ones)
+enum class output_format { text, json, bin };
+
+/**
+ * @brief The bracket specifications: the symbols on each level, and the brackets
+ * selected with @c --select, if any.
+ *
+ * Each element of @p levels is one argument of multibracket, i.e. the symbols of
+ * one level separated by commas or spaces, where FORM's ... operator may be used
+ * (and is expanded by FORM if @p form_ranges is set). If @p cache_dir is not
+ * empty, the expanded symbols are kept there for later runs. Errors are reported
+ * by throwing @c std::runtime_error.
+ *
+ * A specification is never modified, so one may be shared by any number of
+ * parsers, also in different threads.
+ */
+class MULTIBRACKET_API multibracket_spec {
+private:
+    std::unique_ptr<symbol_classifier> cls;
+    std::unique_ptr<bracket_selection> select;
+
+public:
+    explicit multibracket_spec(const std::vector<std::string>& levels,
+                               const std::vector<std::string>& selected = {},
+                               bool form_ranges = false, const std::string& cache_dir = "");
+    ~multibracket_spec();
+
+    multibracket_spec(const multibracket_spec&) = delete;
+    multibracket_spec& operator= (const multibracket_spec&) = delete;
+
+    const symbol_classifier& classifier() const {
+        return *cls;
+    }
+    //Null if no brackets were selected
+    const bracket_selection* selection() const {
+        return select.get();
+    }
+};
+
+/**
+ * @brief Receives the structure of FORM output from a @c multibracket_parser.
+ *
+ * Lines outside expressions are passed to @c text(). Each expression is reported
+ * between @c expression_begin() and @c expression_end() as a tree: the content of
+ * a bracket is passed line by line to @c body_line(), after which its sub-brackets
+ * follow, each between @c bracket_enter() (with its key on its own level) and
+ * @c bracket_leave(). Lines outside any bracket are the content of the expression
+ * itself. Brackets come in the order in which multibracket prints them.
+ *
+ * When streaming, an expression may be reported in several parts, each of which
+ * starts with its own content (if any) and then has some of its top-level
+ * brackets; a key may then occur again in a later part, if FORM did not print its
+ * terms together.
+ *
+ * If the input ends inside an expression, what was read of it is reported, and
+ * @c expression_end() is called with @p complete set to false.
+ *
+ * The views are valid only during the call. The handlers may throw, which ends
+ * parsing, and the exception is passed on by @c multibracket_parser::feed() or
+ * @c finish().
+ */
+struct MULTIBRACKET_API multibracket_events {
+    virtual ~multibracket_events() = default;
+
+    virtual void text(std::string_view /*line*/) {}
+    virtual void expression_begin(std::string_view /*name*/) {}
+    virtual void body_line(std::string_view /*line*/) {}
+    virtual void bracket_enter(std::string_view /*key*/) {}
+    virtual void bracket_leave() {}
+    virtual void expression_end(bool /*complete*/) {}
+};
+
+/**
+ * @brief Where a @c multibracket_parser writes formatted output.
+ */
+struct MULTIBRACKET_API output_sink {
+    virtual ~output_sink() = default;
+
+    virtual void write(const char* data, size_t n) = 0;
+    virtual void flush() {}
+};
+
+/**
+ * @brief Push parser for FORM output with multibracket tags.
+ *
+ * The input is passed to @c feed() in buffers of any size (not necessarily whole
+ * lines), and @c finish() is called at its end. Everything that can be reported
+ * or printed given the input so far is done before @c feed() returns; the parser
+ * keeps the state of unfinished lines, terms and expressions between calls. The
+ * handlers of the events are called from a thread of the parser, but only while
+ * @c feed() or @c finish() is running, so they need no synchronisation.
+ *
+ * Malformed input is reported by throwing @c std::runtime_error from @c feed() or
+ * @c finish(), after which the parser can not be used any more.
+ */
+class MULTIBRACKET_API multibracket_parser {
+private:
+    struct impl;
+    std::unique_ptr<impl> p;
+
+public:
+    /**
+     * @brief Reports the structure of the input to @p events. If @p streaming is set,
+     * each top-level bracket is reported as soon as the next one begins (see
+     * @c multibracket_events).
+     */
+    multibracket_parser(const multibracket_spec& spec, multibracket_events& events,
+                        bool streaming = false);
+
+    /**
+     * @brief Formats the input as multibracket does, and writes it to @p out. The
+     * output is only complete after @c finish().
+     */
+    multibracket_parser(const multibracket_spec& spec, output_sink& out, bool streaming = false,
+                        output_format format = output_format::text);
+
+    //Stops parsing if finish() was not called, reporting nothing more
+    ~multibracket_parser();
+
+    multibracket_parser(const multibracket_parser&) = delete;
+    multibracket_parser& operator= (const multibracket_parser&) = delete;
+
+    void feed(const char* data, size_t n);
+    void feed(std::string_view s){
+        feed(s.data(), s.length());
+    }
+
+    void finish();
+};
+
+/**
+ * @brief The options of the multibracket command (see multibracket.cpp).
+ */
+struct multibracket_options {
+    std::vector<std::string> specs;         //one for each level, or a lookup path
+    bool streaming = false;
+    bool form_ranges = false;
+    bool pipeline = false;
+    std::string batch_src;
+    std::string out_dir;
+    size_t jobs = 0;
+    output_format format = output_format::text;
+    bool with_stats = false;
+    std::string stats_path;
+    std::string cache_dir;
+    std::string index_path;
+    std::string lookup_path;
+    std::vector<std::string> selected;
+    std::vector<std::string> merged;
+    std::string follow_path;
+    std::string output_path;
+    size_t mem_limit = 0;                   //0 for none
+    bool share = false;
+};
+
+/**
+ * @brief Does what the multibracket command does with the given options, reading
+ * standard input unless they name other inputs, and returns its exit status.
+ * Errors are reported on standard error.
+ */
+MULTIBRACKET_API int run_multibracket(const multibracket_options& opts);
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef OUTPUT_INDEX_H
+#define OUTPUT_INDEX_H
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "indent_stream.hpp"
+#include "line_reader.hpp"
+
+/*
+ * Index of a multibracketed output (--index), with which a single expression or
+ * bracket can be found in a large output without reading the rest of it (see
+ * --lookup). It is a text file with one line for each of them, consisting of the
+ * tab-separated fields
+ *
+ *   start      offset in the output of the first byte
+ *   end        offset after the last byte
+ *   terms      number of terms of the input in it
+ *   lines      number of lines of output it spans
+ *   name       name of the expression (empty if it is not known)
+ *   key...     keys of the brackets on the way to it, one field each
+ *
+ * A bracket starts at its key (after the "+ ") and ends after its closing
+ * parenthesis; an expression starts after the line with its name and ends after
+ * the semicolon. Brackets are listed before the brackets they are in.
+ */
+
+/**
+ * @brief Writes the index of what is printed through an @c indent_stream.
+ *
+ * Each expression and bracket is announced by @c begin() before anything of it is
+ * printed, and @c end() after the last of it, in the same nesting as the output.
+ * Since their positions are only known once the text is laid out, @c update()
+ * must be called after every @c paragraph() or flush of the stream that may have
+ * done so; it writes the lines that are complete.
+ */
+class output_index_writer {
+private:
+    struct entry {
+        uint64_t start_mark;
+        uint64_t end_mark;
+        bool has_start;
+        bool has_end;
+        uint64_t start, start_line;
+        uint64_t end, end_line;
+        uint64_t terms;
+        size_t path_length;         //length of path before the key
+        std::string path;           //name and keys (once ended)
+    };
+
+    std::ostream& os;
+    indent_stream& out;
+    std::string path;               //name and keys of the open entries, separated by tabs
+    std::vector<entry> open;
+    std::deque<entry> ended;        //in the order of their ends
+
+    //Copies the positions that have become known, before the marks are released
+    void resolve(entry& e, bool is_ended){
+        if(!e.has_start && out.resolved(e.start_mark)){
+            e.start = out.mark_position(e.start_mark);
+            e.start_line = out.mark_line(e.start_mark);
+            e.has_start = true;
+        }
+        if(is_ended && !e.has_end && out.resolved(e.end_mark)){
+            e.end = out.mark_position(e.end_mark);
+            e.end_line = out.mark_line(e.end_mark);
+            e.has_end = true;
+        }
+    }
+
+public:
+    output_index_writer(std::ostream& o, indent_stream& s)
+    : os(o), out(s), path(), open(), ended() {};
+
+    //Whether an expression has begun and not ended
+    bool in_expression() const {
+        return !open.empty();
+    }
+
+    //Begins an expression (given its name) or a bracket in it (given its key)
+    void begin(std::string_view key){
+        entry e{out.mark(), 0, false, false, 0, 0, 0, 0, 0, path.size(), std::string()};
+        if(!open.empty())
+            path += '\t';
+        path += key;
+        open.push_back(std::move(e));
+    }
+
+    //Counts terms that are directly in the current expression or bracket
+    void add_terms(uint64_t n){
+        open.back().terms += n;
+    }
+
+    void end(){
+        entry e = std::move(open.back());
+        open.pop_back();
+        e.end_mark = out.mark();
+        e.path = path;
+        path.resize(e.path_length);
+        if(!open.empty())
+            open.back().terms += e.terms;
+        ended.push_back(std::move(e));
+    }
+
+    void update(){
+        for(entry& e : open)
+            resolve(e, false);
+        for(entry& e : ended)
+            resolve(e, true);
+        out.release_marks();
+
+        while(!ended.empty() && ended.front().has_end){
+            const entry& e = ended.front();
+            os << e.start << '\t' << e.end << '\t' << e.terms << '\t'
+               << (e.end_line - e.start_line + 1) << '\t' << e.path << '\n';
+            ended.pop_front();
+        }
+    }
+};
+
+/**
+ * @brief Returns the byte ranges that an index gives for an expression or bracket
+ * (more than one if it was printed more than than once), in the order of the index.
+ *
+ * @param path the name of the expression, followed by the keys of the brackets
+ * on the way to the one to find (if any)
+ */
+inline std::vector< std::pair<uint64_t, uint64_t> >
+find_in_index(line_reader& index, const std::vector<std::string>& path){
+    std::string target;
+    for(size_t i = 0; i < path.size(); i++){
+        if(i > 0)
+            target += '\t';
+        target += path[i];
+    }
+
+    std::vector< std::pair<uint64_t, uint64_t> > ranges;
+    std::string_view line;
+    while(index.getline(line)){
+        //Skip the four numbers
+        size_t pos = 0;
+        for(int i = 0; i < 4 && pos != std::string_view::npos; i++){
+            pos = line.find('\t', pos);
+            if(pos != std::string_view::npos)
+                pos++;
+        }
+        if(pos == std::string_view::npos)
+            throw std::runtime_error("ERROR: malformed index line \"" + std::string(line) + "\"");
+        if(line.substr(pos) != target)
+            continue;
+
+        std::string numbers(line.substr(0, pos));
+        char* end;
+        uint64_t start = std::strtoull(numbers.c_str(), &end, 10);
+        uint64_t stop = std::strtoull(end, nullptr, 10);
+        if(stop < start)
+            throw std::runtime_error("ERROR: malformed index line \"" + std::string(line) + "\"");
+        ranges.emplace_back(start, stop);
+    }
+    return ranges;
+}
+
+#endif
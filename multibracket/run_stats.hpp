@@ -0,0 +1,242 @@
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+#include <sys/resource.h>
+
+#include "term_lexer.hpp"
+#include "tree_writer.hpp"
+
+/**
+ * @brief Counts of what was read and built for one expression, or for a whole run.
+ */
+struct stats_counts {
+    std::string name;                   //name of the expression, if known
+
+    uint64_t bytes = 0;                 //input read, including text outside expressions
+    uint64_t lines = 0;
+    uint64_t terms = 0;                 //tagged terms
+    std::vector<uint64_t> nodes;        //number of sub-brackets on each level
+    uint64_t max_content = 0;           //largest number of content lines in one bracket
+    uint64_t peak_arena = 0;            //most bytes allocated for (part of) a tree
+
+    //Wall time in seconds spent waiting for input, parsing (including splitting),
+    //splitting the outside-the-bracket part of terms into factors, and printing
+    double read = 0;
+    double parse = 0;
+    double split = 0;
+    double print = 0;
+
+    void add(const stats_counts& o){
+        bytes += o.bytes;
+        lines += o.lines;
+        terms += o.terms;
+        if(nodes.size() < o.nodes.size())
+            nodes.resize(o.nodes.size());
+        for(size_t lvl = 0; lvl < o.nodes.size(); lvl++)
+            nodes[lvl] += o.nodes[lvl];
+        max_content = std::max(max_content, o.max_content);
+        peak_arena = std::max(peak_arena, o.peak_arena);
+        read += o.read;
+        parse += o.parse;
+        split += o.split;
+        print += o.print;
+    }
+};
+
+/**
+ * @brief Collects the statistics for the --stats option of multibracket, and
+ * reports them at the end of each expression and of the run.
+ *
+ * The report goes to stderr as text, or to a file as JSON, with one object per
+ * line: one for each expression, and a final one for the run with @c "run": true.
+ * Times are taken from a monotonic clock.
+ */
+class run_stats {
+public:
+    using clock = std::chrono::steady_clock;
+
+    stats_counts expression;        //the expression being read
+
+private:
+    stats_counts run;
+    double setup;                   //time spent before reading input
+    clock::time_point start;
+
+    std::ofstream json_file;
+    bool json;
+
+    std::string last_text;          //last non-empty line outside expressions
+    uint64_t bytes_mark, lines_mark;
+    double read_mark;
+
+    static double mb(uint64_t bytes){
+        return bytes / 1e6;
+    }
+
+    void report_text(const stats_counts& c, bool is_run, double total, uint64_t peak_rss){
+        std::ostream& os = std::cerr;
+        os.setf(std::ios::fixed);
+        os.precision(3);
+
+        if(is_run)
+            os << "STATS for the run:\n";
+        else
+            os << "STATS for expression " << (c.name.empty() ? "?" : c.name) << ":\n";
+
+        os << "    input           " << mb(c.bytes) << " MB in " << c.lines << " lines\n"
+           << "    terms           " << c.terms << "\n"
+           << "    nodes per level ";
+        for(size_t lvl = 0; lvl < c.nodes.size(); lvl++)
+            os << (lvl ? ", " : "") << c.nodes[lvl];
+        os << (c.nodes.empty() ? "none" : "") << " (depth " << c.nodes.size() << ")\n"
+           << "    largest content " << c.max_content << " lines\n"
+           << "    time            ";
+        if(is_run)
+            os << "setup " << setup << " s, ";
+        os << "read " << c.read << " s, parse " << c.parse << " s (split " << c.split
+           << " s), print " << c.print << " s";
+        if(is_run)
+            os << ", total " << total << " s";
+        os << "\n"
+           << "    peak arena      " << mb(c.peak_arena) << " MB\n";
+        if(is_run)
+            os << "    peak RSS        " << mb(peak_rss) << " MB\n";
+        os.flush();
+    }
+
+    void report_json(const stats_counts& c, bool is_run, double total, uint64_t peak_rss){
+        std::ostream& os = json_file;
+        os.setf(std::ios::fixed);
+        os.precision(6);
+
+        os << "{";
+        if(is_run)
+            os << "\"run\": true";
+        else{
+            std::string name;
+            append_json_string(name, c.name);
+            os << "\"expression\": " << name;
+        }
+        os << ", \"bytes\": " << c.bytes << ", \"lines\": " << c.lines
+           << ", \"terms\": " << c.terms << ", \"nodes\": [";
+        for(size_t lvl = 0; lvl < c.nodes.size(); lvl++)
+            os << (lvl ? ", " : "") << c.nodes[lvl];
+        os << "], \"depth\": " << c.nodes.size() << ", \"max_content\": " << c.max_content
+           << ", \"seconds\": {";
+        if(is_run)
+            os << "\"setup\": " << setup << ", ";
+        os << "\"read\": " << c.read << ", \"parse\": " << c.parse << ", \"split\": " << c.split
+           << ", \"print\": " << c.print;
+        if(is_run)
+            os << ", \"total\": " << total;
+        os << "}, \"peak_arena_bytes\": " << c.peak_arena;
+        if(is_run)
+            os << ", \"peak_rss_bytes\": " << peak_rss;
+        os << "}" << std::endl;
+    }
+
+    void report(const stats_counts& c, bool is_run){
+        double total = std::chrono::duration<double>(clock::now() - start).count() + setup;
+
+        struct rusage usage;
+        uint64_t peak_rss = (getrusage(RUSAGE_SELF, &usage) == 0) ? uint64_t(usage.ru_maxrss) * 1024 : 0;
+
+        if(json)
+            report_json(c, is_run, total, peak_rss);
+        else
+            report_text(c, is_run, total, peak_rss);
+    }
+
+public:
+    /**
+     * @brief Starts collecting, given the time already spent on setup. The report
+     * is written as JSON to @p json_path, or as text to stderr if it is empty.
+     */
+    run_stats(double setup_seconds, const std::string& json_path)
+    : expression(), run(), setup(setup_seconds), start(clock::now()),
+      json_file(), json(!json_path.empty()), last_text(), bytes_mark(0), lines_mark(0), read_mark(0)
+    {
+        if(json){
+            json_file.open(json_path);
+            if(!json_file)
+                throw std::runtime_error("ERROR: could not open " + json_path);
+        }
+    }
+
+    /**
+     * @brief Remembers a line of text outside expressions, which FORM ends
+     * with the name of the next expression (as in "   F =").
+     */
+    void text(std::string_view lines){
+        std::string_view line = term_lexer::last_line(lines);
+        if(!line.empty())
+            last_text = line;
+    }
+
+    //Called at the first term of an expression
+    void begin_expression(){
+        expression.name = term_lexer::expression_name(last_text);
+    }
+
+    /**
+     * @brief Adds the input read so far to the current expression, given the
+     * totals of the reader.
+     */
+    void input(uint64_t bytes, uint64_t lines, double read_seconds){
+        expression.bytes += bytes - bytes_mark;
+        expression.lines += lines - lines_mark;
+        expression.read += read_seconds - read_mark;
+        bytes_mark = bytes;
+        lines_mark = lines;
+        read_mark = read_seconds;
+    }
+
+    //Reports the current expression, and starts a new one
+    void end_expression(){
+        report(expression, false);
+        run.add(expression);
+        expression = stats_counts();
+    }
+
+    //Reports the whole run, including anything read after the last expression
+    void end_run(){
+        run.add(expression);
+        expression = stats_counts();
+        report(run, true);
+    }
+};
+
+/**
+ * @brief Adds the time from its construction to its destruction to a counter,
+ * unless that is null, in which case it does nothing (and reads no clock).
+ */
+class stats_timer {
+private:
+    double* total;
+    run_stats::clock::time_point start;
+
+public:
+    explicit stats_timer(double* t) : total(t), start() {
+        if(total)
+            start = run_stats::clock::now();
+    }
+    stats_timer(const stats_timer&) = delete;
+    stats_timer& operator= (const stats_timer&) = delete;
+
+    ~stats_timer(){
+        if(total)
+            *total += std::chrono::duration<double>(run_stats::clock::now() - start).count();
+    }
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef SPEC_CACHE_H
+#define SPEC_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "flat_insertion_order_map.hpp"
+
+/**
+ * @brief On-disk cache of resolved bracket specifications.
+ *
+ * Parsing the arguments of multibracket (and in particular expanding ... ranges)
+ * gives a table from symbols to levels. This class stores that table in a small
+ * binary file named after a hash of the arguments, so that later runs with the
+ * same arguments can load it with a single read instead.
+ *
+ * The file consists of native-endian 32-bit integers and raw strings:
+ *
+ *     "MBSPEC01"                      magic
+ *     n_args,    (len, bytes)...      the arguments, to guard against hash collisions
+ *     n_symbols, (level, len, bytes)...   the table, in insertion order
+ *
+ * Files are written under a temporary name and renamed into place, so that
+ * concurrent runs never see a partial file. A missing, stale or damaged file is
+ * simply ignored, as is failure to write one.
+ */
+class spec_cache {
+public:
+    using symbol_map = flat_insertion_order_map< std::string, size_t >;
+
+private:
+    static constexpr char magic[] = "MBSPEC01";
+
+    std::string dir;
+    std::string path;
+    std::vector<std::string> args;
+
+    //FNV-1a, which is stable across runs and platforms (unlike std::hash)
+    static uint64_t hash(const std::vector<std::string>& args){
+        uint64_t h = 14695981039346656037ull;
+        for(const std::string& arg : args){
+            for(char c : arg)
+                h = (h ^ uint8_t(c)) * 1099511628211ull;
+            h = (h ^ 0xff) * 1099511628211ull;      //separator that can't occur in an argument
+        }
+        return h;
+    }
+
+    static void put_u32(std::string& buf, uint32_t x){
+        buf.append(reinterpret_cast<const char*>(&x), sizeof(x));
+    }
+    static void put_str(std::string& buf, std::string_view s){
+        put_u32(buf, uint32_t(s.length()));
+        buf.append(s);
+    }
+
+    //Reading helpers, returning false when running past the end
+    static bool get_u32(std::string_view& buf, uint32_t& x){
+        if(buf.length() < sizeof(x))
+            return false;
+        std::memcpy(&x, buf.data(), sizeof(x));
+        buf.remove_prefix(sizeof(x));
+        return true;
+    }
+    static bool get_str(std::string_view& buf, std::string_view& s){
+        uint32_t len;
+        if(!get_u32(buf, len) || buf.length() < len)
+            return false;
+        s = buf.substr(0, len);
+        buf.remove_prefix(len);
+        return true;
+    }
+
+public:
+    /**
+     * @brief Cache entry for the given arguments (bracket specifications and any
+     * options that affect their meaning) in the given directory.
+     */
+    spec_cache(const std::string& d, const std::vector<std::string>& a)
+    : dir(d), path(), args(a)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/mb-%016llx.spec", (unsigned long long) hash(args));
+        path = dir + name;
+    }
+
+    const std::string& file() const {
+        return path;
+    }
+
+    /**
+     * @brief Loads the table into @p br_symbols (which should be empty).
+     * Returns false, leaving @p br_symbols empty, if there is no valid entry.
+     */
+    bool load(symbol_map& br_symbols) const {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+
+        std::string data;
+        struct stat st;
+        if(fstat(fd, &st) == 0){
+            data.resize(st.st_size);
+            if(::read(fd, data.data(), data.size()) != ssize_t(data.size()))
+                data.clear();
+        }
+        ::close(fd);
+
+        std::string_view buf = data;
+        if(buf.substr(0, sizeof(magic) - 1) != std::string_view(magic, sizeof(magic) - 1))
+            return false;
+        buf.remove_prefix(sizeof(magic) - 1);
+
+        uint32_t n;
+        std::string_view s;
+        if(!get_u32(buf, n) || n != args.size())
+            return false;
+        for(const std::string& arg : args){
+            if(!get_str(buf, s) || s != arg)
+                return false;
+        }
+
+        if(!get_u32(buf, n))
+            return false;
+        br_symbols.reserve(n);
+        for(uint32_t i = 0; i < n; i++){
+            uint32_t level;
+            if(!get_u32(buf, level) || !get_str(buf, s)){
+                br_symbols.clear();
+                return false;
+            }
+            br_symbols.insert(std::make_pair(std::string(s), size_t(level)));
+        }
+        return true;
+    }
+
+    /**
+     * @brief Writes the table to the cache, creating the directory if needed.
+     */
+    void store(const symbol_map& br_symbols) const {
+        std::string buf(magic, sizeof(magic) - 1);
+        put_u32(buf, uint32_t(args.size()));
+        for(const std::string& arg : args)
+            put_str(buf, arg);
+        put_u32(buf, uint32_t(br_symbols.size()));
+        for(auto& [sym, level] : br_symbols){
+            put_u32(buf, uint32_t(level));
+            put_str(buf, sym);
+        }
+
+        ::mkdir(dir.c_str(), 0777);
+
+        std::string tmp_path = path + "." + std::to_string(getpid()) + ".tmp";
+        int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(fd < 0)
+            return;
+
+        bool ok = (::write(fd, buf.data(), buf.size()) == ssize_t(buf.size()));
+        ok = (::close(fd) == 0) && ok;
+
+        if(!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+            std::remove(tmp_path.c_str());
+    }
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef SPILL_FILE_H
+#define SPILL_FILE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdint>
+
+#include <unistd.h>
+
+/**
+ * @brief Temporary file that lines of text are appended to, and read back from
+ * by their offset.
+ *
+ * The file is created in @c $TMPDIR (or @c /tmp) and unlinked at once, so that
+ * it disappears with the process however that ends. Appended text is collected
+ * in a buffer and written in large blocks; reading it back flushes the buffer
+ * first if necessary. Errors are reported by throwing @c std::runtime_error.
+ */
+class spill_file {
+private:
+    static constexpr size_t buffer_size = size_t(1) << 20;
+
+    int fd;
+    std::vector<char> buffer;
+    size_t buffered;
+    uint64_t flushed;           //bytes written to the file
+    std::vector<char> chunk;    //for reading back
+    std::string carry;          //part of a line read with the previous chunk
+
+    void flush(){
+        for(size_t done = 0; done < buffered; ){
+            ssize_t n = ::pwrite(fd, buffer.data() + done, buffered - done, off_t(flushed + done));
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                throw std::runtime_error(std::string("ERROR: could not write spill file: ") + std::strerror(errno));
+            done += n;
+        }
+        flushed += buffered;
+        buffered = 0;
+    }
+
+public:
+    spill_file()
+    : fd(-1), buffer(buffer_size), buffered(0), flushed(0), chunk(), carry()
+    {
+        const char* dir = std::getenv("TMPDIR");
+        std::string path = std::string(dir && *dir ? dir : "/tmp") + "/multibracket.XXXXXX";
+        fd = ::mkstemp(&path[0]);
+        if(fd < 0)
+            throw std::runtime_error("ERROR: could not create spill file " + path + ": " + std::strerror(errno));
+        ::unlink(path.c_str());
+    }
+
+    spill_file(const spill_file&) = delete;
+    spill_file& operator= (const spill_file&) = delete;
+
+    ~spill_file(){
+        ::close(fd);
+    }
+
+    //Total length of the text appended so far
+    uint64_t size() const {
+        return flushed + buffered;
+    }
+
+    /**
+     * @brief Appends a line, which must not contain a newline.
+     */
+    void append_line(std::string_view line){
+        if(buffered + line.length() + 1 > buffer.size()){
+            flush();
+            if(line.length() + 1 > buffer.size())
+                buffer.resize(line.length() + 1);
+        }
+        std::memcpy(buffer.data() + buffered, line.data(), line.length());
+        buffered += line.length();
+        buffer[buffered++] = '\n';
+    }
+
+    /**
+     * @brief Passes the lines in the given range (as appended, from the start of
+     * one to the end of another) to @p f, in order, reading the file sequentially.
+     * The views are valid only during each call.
+     */
+    template< typename F >
+    void read_lines(uint64_t offset, uint64_t bytes, F f){
+        if(offset + bytes > flushed)
+            flush();
+        if(chunk.empty())
+            chunk.resize(buffer_size);
+
+        carry.clear();
+        while(bytes > 0){
+            ssize_t n = ::pread(fd, chunk.data(), std::min<uint64_t>(chunk.size(), bytes), off_t(offset));
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                throw std::runtime_error(std::string("ERROR: could not read spill file: ") + std::strerror(errno));
+            offset += n;
+            bytes -= n;
+
+            const char* p = chunk.data();
+            const char* end = p + n;
+            for(const char* nl; (nl = static_cast<const char*>(std::memchr(p, '\n', end - p))); p = nl + 1){
+                if(carry.empty())
+                    f(std::string_view(p, nl - p));
+                else{
+                    carry.append(p, nl - p);
+                    f(std::string_view(carry));
+                    carry.clear();
+                }
+            }
+            carry.append(p, end - p);
+        }
+    }
+
+    /**
+     * @brief Discards everything appended so far.
+     */
+    void clear(){
+        buffered = 0;
+        flushed = 0;
+        if(::ftruncate(fd, 0) != 0)
+            throw std::runtime_error(std::string("ERROR: could not truncate spill file: ") + std::strerror(errno));
+    }
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @brief Bounded queue between exactly one producer thread and one consumer thread.
+ *
+ * Elements are moved through a ring buffer indexed by two atomic counters, so
+ * pushing and popping take no locks as long as the queue is neither full nor
+ * empty. Only a thread that has to wait takes the mutex, and the other side
+ * only notifies when somebody is waiting.
+ *
+ * Either side may @c close the queue: the producer to signal the end of the
+ * data, the consumer to signal that it has stopped. After that, @c push fails,
+ * and @c pop fails once the remaining elements have been consumed.
+ */
+template< typename T >
+class spsc_queue {
+private:
+    std::vector<T> ring;
+    std::atomic<size_t> head;       //number of elements popped
+    std::atomic<size_t> tail;       //number of elements pushed
+    std::atomic<bool> closed;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<int> waiting;
+
+    template< typename Pred >
+    void wait_until(Pred ready){
+        if(ready())
+            return;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting++;
+        cond.wait(lock, ready);
+        waiting--;
+    }
+
+    void notify(){
+        if(waiting.load() > 0){
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_all();
+        }
+    }
+
+public:
+    explicit spsc_queue(size_t capacity)
+    : ring(capacity), head(0), tail(0), closed(false), mutex(), cond(), waiting(0) {};
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator= (const spsc_queue&) = delete;
+
+    /**
+     * @brief Moves @p x into the queue, waiting while it is full.
+     * Returns false (without moving) if the queue has been closed.
+     */
+    bool push(T&& x){
+        size_t t = tail.load(std::memory_order_relaxed);
+        wait_until([&]{ return closed.load() || t - head.load() < ring.size(); });
+        if(closed.load())
+            return false;
+
+        ring[t % ring.size()] = std::move(x);
+        tail.store(t + 1);
+        notify();
+        return true;
+    }
+
+    /**
+     * @brief Moves the next element into @p x, waiting while the queue is empty.
+     * Returns false if the queue is empty and has been closed.
+     */
+    bool pop(T& x){
+        size_t h = head.load(std::memory_order_relaxed);
+        wait_until([&]{ return closed.load() || tail.load() != h; });
+        if(tail.load() == h)
+            return false;
+
+        x = std::move(ring[h % ring.size()]);
+        head.store(h + 1);
+        notify();
+        return true;
+    }
+
+    /**
+     * @brief Like @c pop, but fails instead of waiting if the queue is empty.
+     */
+    bool try_pop(T& x){
+        size_t h = head.load(std::memory_order_relaxed);
+        if(tail.load() == h)
+            return false;
+
+        x = std::move(ring[h % ring.size()]);
+        head.store(h + 1);
+        notify();
+        return true;
+    }
+
+    void close(){
+        closed.store(true);
+        std::lock_guard<std::mutex> lock(mutex);
+        cond.notify_all();
+    }
+};
+
+#endif
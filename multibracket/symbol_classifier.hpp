@@ -0,0 +1,96 @@
+#ifndef SYMBOL_CLASSIFIER_H
+#define SYMBOL_CLASSIFIER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+
+/**
+ * @brief Immutable map from symbol names to bracket levels, built once from the
+ * expanded symbol list.
+ *
+ * All names are stored in one string, and found through an open-addressing table
+ * (at most half full) holding the offset, length, hash and level of each name, so
+ * that a lookup from a @c std::string_view hashes once, compares hashes before
+ * texts, and never allocates. Since it is never modified, one classifier may be
+ * shared by any number of threads.
+ *
+ * Names that are not in the list belong to the level after the last one; callers
+ * that want to remember those (or any other lookup) across terms should cache the
+ * result per distinct name themselves.
+ */
+class symbol_classifier {
+private:
+    struct slot {
+        uint32_t offset;
+        uint32_t length;
+        size_t hash;
+        uint32_t level;     //empty_slot if the slot is empty
+    };
+    static constexpr uint32_t empty_slot = UINT32_MAX;
+
+    std::string names;
+    std::vector<slot> table;    //size is a power of two
+    size_t n_levels;
+
+    std::string_view name(const slot& s) const {
+        return std::string_view(names).substr(s.offset, s.length);
+    }
+
+    //Finds the slot holding name, or the empty slot where it would go
+    size_t probe(std::string_view n, size_t h) const {
+        size_t mask = table.size() - 1;
+        for(size_t i = h & mask;; i = (i + 1) & mask){
+            const slot& s = table[i];
+            if(s.level == empty_slot || (s.hash == h && name(s) == n))
+                return i;
+        }
+    }
+
+public:
+    /**
+     * @brief Builds the classifier from a map of symbols to levels, which must all
+     * be less than @p levels. If a symbol occurs more than once, the first level
+     * is used.
+     */
+    template< typename Map >
+    symbol_classifier(const Map& symbols, size_t levels)
+    : names(), table(), n_levels(levels)
+    {
+        size_t n_slots = 8;
+        while(n_slots < 2 * symbols.size())
+            n_slots *= 2;
+        table.assign(n_slots, slot{0, 0, 0, empty_slot});
+
+        for(auto& [sym, lvl] : symbols){
+            std::string_view n(sym);
+            size_t h = std::hash<std::string_view>()(n);
+            slot& s = table[probe(n, h)];
+            if(s.level != empty_slot)
+                continue;
+
+            if(names.size() + n.length() > UINT32_MAX)
+                throw std::runtime_error("ERROR: symbol list too long");
+            s = slot{uint32_t(names.size()), uint32_t(n.length()), h, uint32_t(lvl)};
+            names += n;
+        }
+    }
+
+    /**
+     * @brief Returns the level of a symbol, or @c levels() if it has none.
+     */
+    size_t level(std::string_view n) const {
+        const slot& s = table[probe(n, std::hash<std::string_view>()(n))];
+        return s.level == empty_slot ? n_levels : s.level;
+    }
+
+    //Number of levels that symbols are sorted into (not counting unknown symbols)
+    size_t levels() const {
+        return n_levels;
+    }
+};
+
+#endif
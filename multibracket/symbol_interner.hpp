@@ -0,0 +1,141 @@
+#ifndef SYMBOL_INTERNER_H
+#define SYMBOL_INTERNER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+#include "arena.hpp"
+
+/**
+ * @brief Maps each distinct string to a dense 32-bit ID, and back.
+ *
+ * The text of each string is stored once, and looked up through an open-addressing
+ * table of IDs with the hash of each string kept alongside it, so interning a
+ * string that has been seen before costs one hash and (usually) one comparison,
+ * and allocates nothing. Each ID also carries a @c tag, a 32-bit value for the
+ * caller's use (initially @c no_tag), such as a cached classification.
+ */
+class symbol_interner {
+public:
+    using id_type = uint32_t;
+    static constexpr uint32_t no_tag = UINT32_MAX;
+
+private:
+    struct entry {
+        std::string_view text;
+        size_t hash;
+        uint32_t tag;
+    };
+
+    arena storage;
+    std::vector<entry> entries;
+
+    //Slots hold 1 + the ID of an entry, or 0 if empty; the size is a power of two
+    std::vector<id_type> slots;
+
+    void rehash(size_t n_slots){
+        slots.assign(n_slots, 0);
+        size_t mask = n_slots - 1;
+        for(size_t id = 0; id < entries.size(); id++){
+            size_t i = entries[id].hash & mask;
+            while(slots[i] != 0)
+                i = (i + 1) & mask;
+            slots[i] = id_type(id + 1);
+        }
+    }
+
+public:
+    symbol_interner() : storage(), entries(), slots(64, 0) {};
+
+    symbol_interner(const symbol_interner&) = delete;
+    symbol_interner& operator= (const symbol_interner&) = delete;
+
+    /**
+     * @brief Returns the ID of @p s, assigning the next one if it is new.
+     */
+    id_type intern(std::string_view s){
+        size_t h = std::hash<std::string_view>()(s);
+        size_t mask = slots.size() - 1;
+        size_t i = h & mask;
+        for(; slots[i] != 0; i = (i + 1) & mask){
+            const entry& e = entries[slots[i] - 1];
+            if(e.hash == h && e.text == s)
+                return slots[i] - 1;
+        }
+
+        if(entries.size() >= UINT32_MAX - 1)
+            throw std::runtime_error("ERROR: too many distinct symbols");
+
+        id_type id = id_type(entries.size());
+        entries.push_back(entry{storage.copy(s), h, no_tag});
+        slots[i] = id + 1;
+        if(2 * entries.size() > slots.size())
+            rehash(2 * slots.size());
+        return id;
+    }
+
+    std::string_view text(id_type id) const {
+        return entries[id].text;
+    }
+
+    uint32_t& tag(id_type id){
+        return entries[id].tag;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    /**
+     * @brief Forgets all strings, so that their IDs are assigned anew. The memory
+     * is kept for the strings interned next.
+     */
+    void clear(){
+        storage.release();
+        entries.clear();
+        slots.assign(64, 0);
+    }
+
+    /**
+     * @brief Joins the texts of a sequence of IDs with a separator.
+     */
+    std::string join(const id_type* ids, size_t n, char sep = '*') const {
+        std::string s;
+        for(size_t i = 0; i < n; i++){
+            if(i > 0)
+                s += sep;
+            s += text(ids[i]);
+        }
+        return s;
+    }
+
+    /**
+     * @brief Joins the texts of a sequence of IDs with a separator, into @p mem.
+     */
+    std::string_view join(const id_type* ids, size_t n, arena& mem, char sep = '*') const {
+        if(n == 0)
+            return std::string_view();
+
+        size_t length = n - 1;
+        for(size_t i = 0; i < n; i++)
+            length += text(ids[i]).length();
+
+        char* p = static_cast<char*>(mem.allocate(length, 1));
+        char* q = p;
+        for(size_t i = 0; i < n; i++){
+            if(i > 0)
+                *q++ = sep;
+            std::string_view t = text(ids[i]);
+            std::memcpy(q, t.data(), t.length());
+            q += t.length();
+        }
+        return std::string_view(p, length);
+    }
+};
+
+#endif
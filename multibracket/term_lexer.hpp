@@ -0,0 +1,366 @@
+#ifndef TERM_LEXER_H
+#define TERM_LEXER_H
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cctype>
+#include <cstdint>
+
+#include "line_reader.hpp"
+#include "delim_scanner.hpp"
+
+/**
+ * @brief Resumable lexer for FORM output with multibracketed expressions.
+ *
+ * Makes one pass over the lines of a @c line_reader, returning one token per call
+ * to @c next(): lines outside expressions as @c text (as many consecutive lines as
+ * the reader has at hand, separated by newlines), and for each term of an
+ * expression (a line that starts with the prefix given to the constructor) its
+ * start, the factors outside the bracket, the opening parenthesis of the bracket,
+ * its content (one @c body_line for content on the same line as the parenthesis,
+ * otherwise one per non-empty line) and the closing parenthesis. An expression
+ * ends at the semicolon after its last term.
+ *
+ * Tokens are found across line boundaries: FORM wraps long lines, which may put
+ * the " * (" of a term or part of a factor on a later line, and such pieces are
+ * joined back together. The value of a token is a view into the current line, or
+ * into a buffer of the lexer if it was joined, and is valid until the next call.
+ *
+ * Malformed input and input that ends inside a term are reported by throwing
+ * @c std::runtime_error. Input that ends between terms gives @c end_of_input, as
+ * at the end of any other line, so callers should check whether they are inside
+ * an expression then.
+ */
+class term_lexer {
+public:
+    enum class token {
+        text,               //a line outside expressions
+        term_start,
+        factor,             //a factor outside the bracket
+        bracket_open,
+        body_line,          //a line of content of the bracket
+        bracket_close,
+        expression_end,
+        end_of_input
+    };
+
+private:
+    enum class state {
+        outside,            //outside expressions
+        between_terms,      //inside an expression, looking for the next term
+        key,                //outside the bracket of a term
+        body,               //just after the opening parenthesis
+        body_lines,         //in content that starts on a line of its own
+        close,              //at the closing parenthesis
+        after_term          //just after the closing parenthesis
+    };
+
+    //Factors are separated by '*' or blanks outside parentheses. Content on the line of
+    //the opening parenthesis ends at the matching closing one outside formal names
+    //([...]), which are handled explicitly
+    static constexpr delim_scanner factor_scanner{"*", "[]()", " \t"};
+    static constexpr delim_scanner body_scanner{"", "", "[]()"};
+
+    line_reader& in;
+    std::string_view prefix;
+    state st;
+
+    std::string_view line;
+    size_t pos;
+
+    std::string joined;         //value of a token spanning several lines
+    std::string_view val;
+    bool skipping;              //whether content is skipped rather than read
+
+    static bool is_blank(char c){
+        return std::isspace(uint8_t(c));
+    }
+    static bool is_plusminus(char c){
+        return c == '+' || c == '-';
+    }
+
+    bool next_line(){
+        pos = 0;
+        return in.getline(line);
+    }
+
+    void skip_blanks(){
+        while(pos < line.length() && is_blank(line[pos]))
+            pos++;
+    }
+
+    token start_term(){
+        pos = prefix.length();
+        st = state::key;
+        return token::term_start;
+    }
+
+    //Reads the next factor, or the opening parenthesis after the last one
+    token lex_key(){
+        for(;;){
+            skip_blanks();
+            if(pos < line.length() && line[pos] == '*'){
+                pos++;
+                continue;
+            }
+            if(pos < line.length())
+                break;
+
+            //The line was wrapped between factors
+            if(!next_line())
+                throw std::runtime_error("ERROR: unexpected EOF in bracket key");
+        }
+
+        if(line[pos] == '('){
+            pos++;
+            st = state::body;
+            return token::bracket_open;
+        }
+
+        size_t start = pos, depth = 0;
+        bool wrapped = false;
+        for(;;){
+            pos = factor_scanner.next(line, pos);
+
+            if(pos == line.length()){
+                if(depth == 0)
+                    break;
+
+                //The line was wrapped inside parentheses: join it with the next one
+                if(!wrapped)
+                    joined.clear();
+                joined += line.substr(start);
+                wrapped = true;
+                if(!next_line())
+                    throw std::runtime_error("ERROR: unexpected EOF in bracket key");
+                skip_blanks();
+                start = pos;
+                continue;
+            }
+
+            uint8_t cls = factor_scanner.classify(line[pos]);
+            if(cls & delim_scanner::left_par)
+                depth++;
+            else if(cls & delim_scanner::right_par){
+                if(depth == 0)
+                    break;
+                depth--;
+            }
+            else if(depth == 0)
+                break;
+            pos++;
+        }
+
+        if(wrapped){
+            joined += line.substr(start, pos - start);
+            val = joined;
+        }
+        else
+            val = line.substr(start, pos - start);
+
+        if(val.empty())
+            throw std::runtime_error("ERROR: malformed bracket key in line \"" + std::string(line) + "\"");
+        return token::factor;
+    }
+
+    //Reads the content on the line of the opening parenthesis up to the closing one,
+    //joining lines if necessary, and leaves pos at the closing parenthesis. The character
+    //before it (normally a blank) is not included.
+    void lex_inline_body(){
+        size_t start = pos;
+        size_t par = 0, fpar = 0;
+        bool wrapped = false;
+
+        for(;; pos++){
+            pos = body_scanner.next(line, pos);
+
+            while(pos >= line.length()){
+                if(!wrapped)
+                    joined.clear();
+                wrapped = true;
+
+                if(!skipping){
+                    joined += line.substr(start);
+                    if(!line.empty() && is_plusminus(line.back()))
+                        joined += ' ';
+                }
+
+                if(!next_line()){
+                    //Skipped content is not joined, so there is no line to show
+                    if(skipping)
+                        throw std::runtime_error("ERROR: unexpected EOF in bracket");
+                    throw std::runtime_error("ERROR: unexpected EOF in line \"" + joined + "\"");
+                }
+                skip_blanks();
+                start = pos;
+
+                if(!skipping && start < line.length() && is_plusminus(line[start]))
+                    joined += ' ';
+                pos = body_scanner.next(line, start);
+            }
+
+            char c = line[pos];
+            if(c == '[')
+                fpar++;
+            else if(c == ']')
+                fpar--;
+            else if(fpar == 0){
+                if(par == 0 && c == ')')
+                    break;
+                else if(c == '(')
+                    par++;
+                else if(c == ')')
+                    par--;
+            }
+        }
+
+        std::string_view last = (pos > start) ? line.substr(start, pos - 1 - start) : std::string_view();
+        if(wrapped){
+            joined += last;
+            val = joined;
+        }
+        else
+            val = last;
+    }
+
+public:
+    term_lexer(line_reader& i, std::string_view term_prefix)
+    : in(i), prefix(term_prefix), st(state::outside), line(), pos(0), joined(), val(), skipping(false) {};
+
+    term_lexer(const term_lexer&) = delete;
+    term_lexer& operator= (const term_lexer&) = delete;
+
+    /**
+     * @brief Returns the next token. After @c end_of_input, all further calls
+     * return @c end_of_input too.
+     */
+    token next(){
+        for(;;){
+            switch(st){
+            case state::outside:
+                if(in.getlines_before(prefix, val))
+                    return token::text;
+                if(!next_line())
+                    return token::end_of_input;
+                if(line.compare(0, prefix.length(), prefix) == 0)
+                    return start_term();
+                val = line;
+                return token::text;
+
+            case state::between_terms:
+                if(!next_line())
+                    return token::end_of_input;
+                if(line.compare(0, prefix.length(), prefix) == 0)
+                    return start_term();
+                //Anything else inside an expression is ignored
+                break;
+
+            case state::key:
+                return lex_key();
+
+            case state::body:
+                skip_blanks();
+                if(pos == line.length()){
+                    st = state::body_lines;
+                    break;
+                }
+
+                lex_inline_body();
+                st = state::close;
+                if(!val.empty())
+                    return token::body_line;
+                break;
+
+            case state::body_lines:
+                if(!next_line())
+                    throw std::runtime_error("ERROR: unexpected EOF in bracket");
+                skip_blanks();
+                if(pos == line.length())
+                    break;
+                if(line[pos] == ')'){
+                    st = state::close;
+                    break;
+                }
+                val = line.substr(pos);
+                return token::body_line;
+
+            case state::close:
+                st = state::after_term;
+                return token::bracket_close;
+
+            case state::after_term:
+                //The expression ends if a semicolon follows, on this line or the next
+                pos++;
+                skip_blanks();
+                if(pos == line.length()){
+                    if(!next_line())
+                        return token::end_of_input;
+                    if(line.compare(0, prefix.length(), prefix) == 0)
+                        return start_term();
+                    skip_blanks();
+                }
+
+                if(pos < line.length() && line[pos] == ';'){
+                    st = state::outside;
+                    return token::expression_end;
+                }
+                st = state::between_terms;
+                break;
+            }
+        }
+    }
+
+    std::string_view value() const {
+        return val;
+    }
+
+    /**
+     * @brief Skips the content of a bracket after its @c bracket_open, up to and
+     * including the @c bracket_close, without joining wrapped lines.
+     */
+    void skip_body(){
+        //Reset even if next() throws, so that a caller that goes on reads content again
+        struct reset {
+            bool& flag;
+            ~reset(){ flag = false; }
+        } guard{skipping};
+
+        skipping = true;
+        while(next() == token::body_line)
+            ;
+    }
+
+    /**
+     * @brief Returns the last line of @p text (several lines, as in a @c text token)
+     * that is not blank, or an empty view if there is none.
+     */
+    static std::string_view last_line(std::string_view text){
+        size_t end = text.find_last_not_of(" \t\n");
+        if(end == std::string_view::npos)
+            return std::string_view();
+
+        size_t begin = text.rfind('\n', end);
+        begin = (begin == std::string_view::npos) ? 0 : begin + 1;
+        return text.substr(begin, end + 1 - begin);
+    }
+
+    /**
+     * @brief Returns the name of the expression announced by a line of FORM output
+     * (as in "   F ="), or an empty view if the line announces none.
+     */
+    static std::string_view expression_name(std::string_view line){
+        size_t end = line.find_last_not_of(" \t");
+        if(end == std::string_view::npos || line[end] != '=')
+            return std::string_view();
+
+        line = line.substr(0, end);
+        size_t begin = line.find_first_not_of(" \t");
+        end = line.find_last_not_of(" \t");
+        if(begin == std::string_view::npos)
+            return std::string_view();
+        return line.substr(begin, end + 1 - begin);
+    }
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef TREE_WRITER_H
+#define TREE_WRITER_H
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdio>
+
+#include "flat_insertion_order_map.hpp"
+#include "arena.hpp"
+
+/*
+ * Structured output of multibracket (--format=json and --format=bin). The output
+ * is a sequence of records, each of which is one of:
+ *
+ *   text           text outside expressions, exactly as it would be printed
+ *   expression     a whole expression
+ *   part           a part of an expression printed with --stream: consecutive
+ *                  parts followed by an expression record (holding the rest) make
+ *                  up one expression
+ *   unfinished     what was read of an expression before an error
+ *
+ * The trees of the last three consist of nodes with a key (empty for the root),
+ * lines of content and sub-brackets, in the order in which they are printed as
+ * text. A writer is given a tree node by node, in depth-first order: begin_tree(),
+ * then for each node begin_node(), content() for each line, end_content(), the
+ * sub-brackets and end_node(), and finally end_tree(). The strings passed need
+ * only be valid during each call (content may be read back from a spill file).
+ */
+enum class record_type : uint32_t { text = 0, expression = 1, part = 2, unfinished = 3 };
+
+//Appends a string to out as a JSON string literal
+inline void append_json_string(std::string& out, std::string_view s){
+    out += '"';
+    for(char c : s){
+        if(c == '"' || c == '\\'){
+            out += '\\';
+            out += c;
+        }
+        else if(c == '\n')
+            out += "\\n";
+        else if(c == '\t')
+            out += "\\t";
+        else if(uint8_t(c) < 0x20){
+            char esc[8];
+            std::snprintf(esc, sizeof(esc), "\\u%04x", unsigned(c));
+            out += esc;
+        }
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+/**
+ * @brief Writes records as JSON, one object per line.
+ *
+ * Text records are written as <tt>{"type": "text", "text": "..."}</tt>, and trees as
+ * <tt>{"type": "expression", "name": "F", "content": [...], "brackets": [...]}</tt>,
+ * where each element of "brackets" is an object <tt>{"key": "...", "content": [...],
+ * "brackets": [...]}</tt>. The name is empty if it is not known.
+ */
+class json_tree_writer {
+private:
+    static constexpr size_t flush_size = size_t(1) << 20;
+
+    std::ostream& os;
+    std::string buf;
+    std::vector<bool> first;        //for each open node, whether no element has been written yet
+
+    void flush(){
+        os.write(buf.data(), buf.size());
+        buf.clear();
+    }
+
+    void element(){
+        if(!first.back())
+            buf += ", ";
+        first.back() = false;
+    }
+
+public:
+    explicit json_tree_writer(std::ostream& o) : os(o), buf(), first() {};
+
+    void text(std::string_view s){
+        buf += "{\"type\": \"text\", \"text\": ";
+        append_json_string(buf, s);
+        buf += "}\n";
+        flush();
+    }
+
+    void begin_tree(record_type type, std::string_view name){
+        static const char* const names[] = {"text", "expression", "part", "unfinished"};
+        buf += "{\"type\": \"";
+        buf += names[size_t(type)];
+        buf += "\", \"name\": ";
+        append_json_string(buf, name);
+    }
+
+    void begin_node(std::string_view key, size_t, size_t){
+        if(first.empty())
+            buf += ", \"content\": [";
+        else{
+            element();
+            buf += "{\"key\": ";
+            append_json_string(buf, key);
+            buf += ", \"content\": [";
+        }
+        first.push_back(true);
+    }
+
+    void content(std::string_view line){
+        element();
+        append_json_string(buf, line);
+    }
+
+    void end_content(){
+        buf += "], \"brackets\": [";
+        first.back() = true;
+    }
+
+    void end_node(){
+        first.pop_back();
+        buf += "]}";
+        if(buf.size() >= flush_size)
+            flush();
+    }
+
+    void end_tree(){
+        buf += "\n";
+        flush();
+    }
+};
+
+/**
+ * @brief Writes records in a binary format that can be read in place (e.g. from a
+ * memory-mapped file), skipping whole records and subtrees without parsing them.
+ *
+ * All integers are little-endian, and everything is aligned to 8 bytes. The output
+ * starts with the 8 bytes "MBTREE1\n", followed by the records, each of which is
+ *
+ *   u32 type           a record_type
+ *   u32 reserved       (zero)
+ *   u64 size           size of the body in bytes, excluding the padding after it
+ *   body, padded with zeros to a multiple of 8 bytes
+ *
+ * The body of a text record is the text. That of a tree is
+ *
+ *   u32 name           index of the name of the expression in the string table,
+ *                      or 0xffffffff if it is not known
+ *   u32 n_strings
+ *   u64 offsets[n_strings + 1]     string i is the bytes from offsets[i] to
+ *                                  offsets[i+1] of the string data
+ *   string data, padded to a multiple of 8 bytes
+ *   root node
+ *
+ * and each node is
+ *
+ *   u64 size           size of the node in bytes, including its sub-brackets
+ *   u32 key            index of the key in the string table (0xffffffff for the root)
+ *   u32 n_content
+ *   u32 n_sub
+ *   u32 content[n_content]         indices of the content lines in the string table
+ *   padding to a multiple of 8 bytes
+ *   n_sub nodes
+ *
+ * Identical strings are stored once per record. Each tree is collected in memory
+ * before it is written, since its string table comes first.
+ */
+class bin_tree_writer {
+public:
+    static constexpr uint32_t no_string = UINT32_MAX;
+
+private:
+    std::ostream& os;
+
+    flat_insertion_order_map< std::string_view, uint32_t > index;     //the string table
+    arena copies;                   //of the strings in the table
+    std::string strings;
+    std::string nodes;
+    std::vector<size_t> open;       //offsets of the nodes being written
+    record_type type;
+    uint32_t name;
+
+    static void put32(std::string& s, uint32_t v){
+        char b[4];
+        for(int i = 0; i < 4; i++)
+            b[i] = char(v >> (8 * i));
+        s.append(b, 4);
+    }
+    static void put64(std::string& s, uint64_t v){
+        char b[8];
+        for(int i = 0; i < 8; i++)
+            b[i] = char(v >> (8 * i));
+        s.append(b, 8);
+    }
+    static void set64(std::string& s, size_t at, uint64_t v){
+        for(int i = 0; i < 8; i++)
+            s[at + i] = char(v >> (8 * i));
+    }
+    static void pad(std::string& s){
+        s.append((8 - s.size() % 8) % 8, '\0');
+    }
+
+    uint32_t intern(std::string_view s){
+        auto it = index.find(s);
+        if(it != index.end())
+            return it->second;
+
+        if(index.size() >= no_string)
+            throw std::runtime_error("ERROR: too many distinct strings in one record for --format=bin");
+        uint32_t i = uint32_t(index.size());
+        index.insert(std::make_pair(copies.copy(s), i));
+        return i;
+    }
+
+    void record(record_type t, std::string_view body_start, std::string_view body_rest,
+                std::string_view body_end)
+    {
+        std::string header;
+        put32(header, uint32_t(t));
+        put32(header, 0);
+        put64(header, body_start.size() + body_rest.size() + body_end.size());
+        os.write(header.data(), header.size());
+        os.write(body_start.data(), body_start.size());
+        os.write(body_rest.data(), body_rest.size());
+        os.write(body_end.data(), body_end.size());
+
+        static const char zeros[8] = {};
+        os.write(zeros, (8 - (body_start.size() + body_rest.size() + body_end.size()) % 8) % 8);
+    }
+
+public:
+    explicit bin_tree_writer(std::ostream& o)
+    : os(o), index(), copies(), strings(), nodes(), open(), type(record_type::expression), name(no_string) {};
+
+    //Writes the magic bytes at the start of the output
+    void start(){
+        os.write("MBTREE1\n", 8);
+    }
+
+    void text(std::string_view s){
+        record(record_type::text, s, "", "");
+    }
+
+    void begin_tree(record_type t, std::string_view n){
+        type = t;
+        name = n.empty() ? no_string : intern(n);
+    }
+
+    void begin_node(std::string_view key, size_t n_content, size_t n_sub){
+        if(n_content > UINT32_MAX || n_sub > UINT32_MAX)
+            throw std::runtime_error("ERROR: bracket too large for --format=bin");
+        open.push_back(nodes.size());
+        put64(nodes, 0);
+        put32(nodes, open.size() == 1 ? no_string : intern(key));
+        put32(nodes, uint32_t(n_content));
+        put32(nodes, uint32_t(n_sub));
+    }
+
+    void content(std::string_view line){
+        put32(nodes, intern(line));
+    }
+
+    void end_content(){
+        pad(nodes);
+    }
+
+    void end_node(){
+        pad(nodes);
+        set64(nodes, open.back(), nodes.size() - open.back());
+        open.pop_back();
+    }
+
+    void end_tree(){
+        std::string table;
+        put32(table, name);
+        put32(table, uint32_t(index.size()));
+
+        uint64_t offset = 0;
+        put64(table, offset);
+        for(auto& [s, i] : index){
+            strings += s;
+            offset += s.size();
+            put64(table, offset);
+        }
+        pad(strings);
+
+        record(type, table, strings, nodes);
+
+        index.clear();
+        copies.release();
+        strings.clear();
+        nodes.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <utility>
+
+/**
+ * @brief Fixed-size thread pool with work stealing.
+ *
+ * Each worker has its own deque of tasks. Tasks submitted from inside a task go
+ * to the back of the current worker's deque, and the worker takes its next task
+ * from the back as well, so that related work (such as the pieces of one file)
+ * tends to stay on one thread. A worker whose deque is empty steals from the
+ * front of the others' deques, where the oldest (and typically largest) tasks are.
+ * Tasks submitted from outside the pool are dealt out round-robin.
+ *
+ * Idle workers sleep until a task is submitted. If a task throws, the first
+ * exception is rethrown by @c wait, after all tasks have finished.
+ */
+class work_pool {
+public:
+    using task = std::function<void()>;
+
+private:
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    std::vector< std::unique_ptr<worker_queue> > queues;
+    std::vector<std::thread> threads;
+
+    std::atomic<size_t> queued;         //tasks waiting in the deques
+    std::atomic<size_t> pending;        //tasks submitted but not finished
+    std::atomic<size_t> next_queue;     //for round-robin submission
+    bool stopping;
+
+    std::mutex idle_mutex;
+    std::condition_variable idle_cond;  //a task was submitted, or the pool is stopping
+    std::condition_variable done_cond;  //pending dropped to zero
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    //Index of the worker running on this thread, if it belongs to this pool
+    static inline thread_local const work_pool* current_pool = nullptr;
+    static inline thread_local size_t current_index = 0;
+
+    bool pop_back(size_t i, task& t){
+        worker_queue& q = *queues[i];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if(q.tasks.empty())
+            return false;
+
+        t = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        queued--;
+        return true;
+    }
+
+    bool steal(size_t thief, task& t){
+        for(size_t k = 1; k < queues.size(); k++){
+            worker_queue& q = *queues[(thief + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if(!q.tasks.empty()){
+                t = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(task& t){
+        try{
+            t();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if(!error)
+                error = std::current_exception();
+        }
+        t = nullptr;
+
+        if(--pending == 0){
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            done_cond.notify_all();
+        }
+    }
+
+    void work(size_t i){
+        current_pool = this;
+        current_index = i;
+
+        for(task t;;){
+            if(pop_back(i, t) || steal(i, t)){
+                run(t);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(idle_mutex);
+            idle_cond.wait(lock, [&]{ return stopping || queued.load() > 0; });
+            if(stopping && queued.load() == 0)
+                return;
+        }
+    }
+
+public:
+    /**
+     * @brief Starts @p n_threads workers (default: one per hardware thread).
+     */
+    explicit work_pool(size_t n_threads = std::thread::hardware_concurrency())
+    : queues(), threads(), queued(0), pending(0), next_queue(0), stopping(false),
+      idle_mutex(), idle_cond(), done_cond(), error_mutex(), error()
+    {
+        if(n_threads == 0)
+            n_threads = 1;
+
+        for(size_t i = 0; i < n_threads; i++)
+            queues.emplace_back(new worker_queue());
+        for(size_t i = 0; i < n_threads; i++)
+            threads.emplace_back(&work_pool::work, this, i);
+    }
+
+    work_pool(const work_pool&) = delete;
+    work_pool& operator= (const work_pool&) = delete;
+
+    /**
+     * @brief Finishes all submitted tasks and stops the workers.
+     */
+    ~work_pool(){
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            stopping = true;
+        }
+        idle_cond.notify_all();
+        for(std::thread& th : threads)
+            th.join();
+    }
+
+    size_t size() const {
+        return threads.size();
+    }
+
+    void submit(task t){
+        size_t i = (current_pool == this)
+            ? current_index
+            : next_queue++ % queues.size();
+
+        pending++;
+        {
+            worker_queue& q = *queues[i];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(t));
+            queued++;
+        }
+
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle_cond.notify_one();
+    }
+
+    /**
+     * @brief Waits until all submitted tasks (including those they submitted in
+     * turn) have finished. Must not be called from inside a task.
+     */
+    void wait(){
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        done_cond.wait(lock, [&]{ return pending.load() == 0; });
+
+        if(error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+};
+
+#endif